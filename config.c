@@ -90,7 +90,7 @@ void get_config()
 					cprint(POP_Y+1, POP_X+3,
 						"Test Selection:");
 					cprint(POP_Y+4, POP_X+5,
-						"Test Number [1-11]: ");
+						"Test Number [1-12]: ");
 					n = getval(POP_Y+4, POP_X+24, 0) - 1;
 					if (n <= 11) 
 						{
@@ -11,8 +11,9 @@ struct cpu_ident cpu_id;
 
 void get_cpuid()
 {
-	unsigned int *v, dummy[3];
+	unsigned int *v, dummy[3], sub;
 	char *p, *q;
+	int n;
 
 	/* Get max std cpuid & vendor ID */
 	cpuid(0x0, &cpu_id.max_cpuid, &cpu_id.vend_id.uint32_array[0],
@@ -25,6 +26,18 @@ void get_cpuid()
 		&cpu_id.fid.uint32_array[1], &cpu_id.fid.uint32_array[0]);
 	}
 
+	/* Get the structured extended feature flags, save EBX and ECX */
+	if (cpu_id.max_cpuid >= 7) {
+		cpuid_count(0x00000007, 0, &dummy[0], &cpu_id.efid.flat,
+		    &cpu_id.ext_ecx, &dummy[2]);
+	}
+
+	/* Get the XSAVE state components the processor supports */
+	if (cpu_id.max_cpuid >= 0xd && cpu_id.fid.bits.xsave) {
+		cpuid_count(0x0000000d, 0, &cpu_id.xcr0_mask, &dummy[0],
+		    &dummy[1], &dummy[2]);
+	}
+
 	/* Get the digital thermal sensor & power management status bits */
 	if(cpu_id.max_cpuid >= 6)	{
 		cpuid(0x00000006, &cpu_id.dts_pmp, &dummy[0], &dummy[1], &dummy[2]);
@@ -81,6 +94,23 @@ void get_cpuid()
 	    break;
 	}
 
+	/* Find the deepest C-state MWAIT enters, from the number of sub
+	 * C-states leaf 5 lists for each of C1 to C7 */
+	cpu_id.mwait_hint = -1;
+	if (cpu_id.fid.bits.mon) {
+	    cpu_id.mwait_hint = 0;
+	    if (cpu_id.max_cpuid >= 5) {
+		cpuid(0x00000005, &dummy[0], &dummy[1], &dummy[2], &sub);
+		for (n = 7; n > 0 && (dummy[2] & 1); n--) {
+		    if ((sub >> (n * 4)) & 0xf) {
+			cpu_id.mwait_hint = ((n - 1) << 4) |
+			    (((sub >> (n * 4)) & 0xf) - 1);
+			break;
+		    }
+		}
+	    }
+	}
+
 	/* Turn off mon bit since monitor based spin wait may not be reliable */
 	cpu_id.fid.bits.mon = 0;
 
@@ -156,13 +156,31 @@ typedef union {
       uint32_t    smx:1;      	
       uint32_t    eist:1;  
       uint32_t    tm2:1;       		     		
-      uint32_t    bits_9_31:23;
+      uint32_t    bits_9_25:17;
+      uint32_t    xsave:1;
+      uint32_t    osxsave:1;
+      uint32_t    avx:1;
+      uint32_t    bits_29_31:3;
       uint32_t    bits0_28:29;     /* EDX extended feature flags, bit 0 */
       uint32_t    lm:1;		   /* Long Mode */
       uint32_t    bits_30_31:2;    /* EDX extended feature flags, bit 32 */
    } bits;
 } cpuid_feature_flags_t;
 
+/* Typedef for storing CPUID leaf 7 structured extended feature flags */
+typedef union {
+   uint32_t flat;
+   struct {
+      uint32_t    bits_0_4:5;      /* EBX feature flags, bit 0 */
+      uint32_t    avx2:1;
+      uint32_t    bits_6_15:10;
+      uint32_t    avx512f:1;
+      uint32_t    bits_17_31:15;   /* EBX feature flags, bit 31 */
+   } bits;
+} cpuid_ext_feature_flags_t;
+
+#define CPUID7_ECX_WAITPKG	(1 << 5)	/* TPAUSE, UMONITOR, UMWAIT */
+
 /* An overall structure to cache all of the CPUID information */
 struct cpu_ident {
 	uint32_t max_cpuid;
@@ -171,6 +189,10 @@ struct cpu_ident {
 	cpuid_version_t vers;
 	cpuid_proc_info_t info;
 	cpuid_feature_flags_t fid;
+	cpuid_ext_feature_flags_t efid;
+	uint32_t ext_ecx;		/* leaf 7 ECX feature flags */
+	int32_t mwait_hint;		/* deepest MWAIT hint, -1 = no MWAIT */
+	uint32_t xcr0_mask;		/* XCR0 bits the CPU supports */
 	cpuid_vendor_string_t vend_id;
 	cpuid_brand_string_t brand_id;
 	cpuid_cache_info_t cache_info;
@@ -20,6 +20,8 @@
 #define SETUPSEG	(INITSEG+0x20)		/* Segment adrs for relocated setup */
 #define TSTLOAD		0x1000			/* Segment adrs for load of test */
 
+#define AP_BOOT_LOCK	0x9200			/* Held by an AP on the boot stack */
+
 #define KERNEL_CS	0x10			/* 32 bit segment adrs for code */
 #define KERNEL_DS	0x18			/* 32 bit segment adrs for data */
 #define REAL_CS		0x20			/* 16 bit segment adrs for code */
@@ -12,6 +12,8 @@
 #include "test.h"
 #include "stdint.h"
 
+extern char toupper(char c);
+
 #define round_up(x,y) (((x) + (y) - 1) & ~((y)-1))
 #define round_down(x,y) ((x) & ~((y)-1))
 
@@ -149,6 +151,17 @@ int md_maps_count=0;
 int dmi_err_cnts[MAX_DMI_MEMDEVS];
 short dmi_initialized=0;
 
+//address ranges of the memory devices sorted by start, in pages with an
+//inclusive end, for looking up error addresses by binary search
+struct dmi_ival {
+	ulong start;
+	ulong end;
+	ulong max_end;		//highest end of this and all earlier ranges
+	int dev;		//index into mem_devs and dmi_err_cnts
+};
+static struct dmi_ival dmi_ivals[MAX_DMI_MEMDEVS];
+static int dmi_ivals_count=0;
+
 char * get_tstruct_string(struct tstruct_header *header, int n){
 	if(n<1)
 		return 0;
@@ -209,11 +222,11 @@ int open_dmi(void){
 	while(dmi < table_start + eps->tablelength){
 		struct tstruct_header *header = (struct tstruct_header *)dmi;
 		
-		if (header->type == 17)
+		if (header->type == 17 && mem_devs_count < MAX_DMI_MEMDEVS)
 			mem_devs[mem_devs_count++] = (struct mem_dev *)dmi;
 		
 		// Mem Dev Map
-		if (header->type == 20)
+		if (header->type == 20 && md_maps_count < MAX_DMI_MEMDEVS)
 			md_maps[md_maps_count++] = (struct md_map *)dmi;
 
 		// MB_SPEC
@@ -240,11 +253,41 @@ int open_dmi(void){
 	return 0;
 }
 
+//build the sorted table of device address ranges
+static void dmi_index(void){
+	struct dmi_ival iv;
+	int i,j,k;
+
+	dmi_ivals_count=0;
+	for(i=0; i < md_maps_count; i++){
+		for(j=0; j < mem_devs_count; j++){
+			if (mem_devs[j]->header.handle == md_maps[i]->md_handle)
+				break;
+		}
+		if (j == mem_devs_count || md_maps[i]->end < md_maps[i]->start)
+			continue;
+		//start and end are in KB
+		iv.start = md_maps[i]->start >> 2;
+		iv.end = md_maps[i]->end >> 2;
+		iv.dev = j;
+		for(k=dmi_ivals_count; k > 0 && dmi_ivals[k-1].start > iv.start; k--)
+			dmi_ivals[k] = dmi_ivals[k-1];
+		dmi_ivals[k] = iv;
+		dmi_ivals_count++;
+	}
+	for(i=0; i < dmi_ivals_count; i++){
+		dmi_ivals[i].max_end = dmi_ivals[i].end;
+		if (i && dmi_ivals[i-1].max_end > dmi_ivals[i].end)
+			dmi_ivals[i].max_end = dmi_ivals[i-1].max_end;
+	}
+}
+
 void init_dmi(void){
 	int i;
 	for(i=0; i < MAX_DMI_MEMDEVS; i++)
 		dmi_err_cnts[i]=0;
 	open_dmi();
+	dmi_index();
 	dmi_initialized=1;
 }
 
@@ -384,27 +427,90 @@ void print_dmi_info(void){
 	}
 }
 	
-//return 1 if the list of bad memory devices changes, 0 otherwise, -1 if no mapped
-int add_dmi_err(ulong adr){
-	int i,j,found=-1;
-	
+/* Does the locator match the name up to the next ',' or ' '?  The
+ * names come from the command line, so spaces in the locator are
+ * skipped and case is ignored. */
+static int dmi_locator_match(char *loc, char *name)
+{
+	if (!loc)
+		return 0;
+	for (;;) {
+		while (*loc == ' ')
+			loc++;
+		if (*name == 0 || *name == ',' || *name == ' ')
+			return *loc == 0;
+		if (toupper(*loc) != toupper(*name))
+			return 0;
+		loc++;
+		name++;
+	}
+}
+
+//test only the memory mapped to the devices in the comma separated list,
+//return the number of address ranges found
+int dmi_select(char *names){
+	int i,j,found=0;
+	char *cp;
+
 	if(!dmi_initialized)
 		init_dmi();
-	
-	for(i=0; i < md_maps_count; i++){
-		if ( adr < (md_maps[i]->start<<10) ||
-		     adr > (md_maps[i]->end<<10) )
+
+	for(i=0; i < mem_devs_count; i++){
+		char *loc = get_tstruct_string(&(mem_devs[i]->header),
+					       mem_devs[i]->dev_locator);
+
+		for (cp = names; *cp && *cp != ' '; ) {
+			if (dmi_locator_match(loc, cp))
+				break;
+			while (*cp && *cp != ',' && *cp != ' ')
+				cp++;
+			if (*cp == ',')
+				cp++;
+		}
+		if (!*cp || *cp == ' ')
 			continue;
 
-		//matching map found, now check find corresponding dev
-		for(j=0; j < mem_devs_count; j++){
-			if (mem_devs[j]->header.handle != md_maps[i]->md_handle)
+		//start and end are in KB, end is the last KB of the range
+		for(j=0; j < md_maps_count; j++){
+			if (mem_devs[i]->header.handle != md_maps[j]->md_handle)
 				continue;
-			if (dmi_err_cnts[j]){
+			mem_range_add(0, md_maps[j]->start >> 2,
+				      (md_maps[j]->end >> 2) + 1);
+			found++;
+		}
+	}
+	return found;
+}
+
+//count an error at a physical page against the memory devices mapped there,
+//return 1 if the list of bad memory devices changes, 0 otherwise, -1 if no mapped
+int add_dmi_err(ulong page){
+	int lo,hi,mid,found=-1;
+
+	if(!dmi_initialized)
+		return -1;
+
+	//find the last range starting at or below the page
+	lo=0;
+	hi=dmi_ivals_count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (dmi_ivals[mid].start <= page)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	//interleaved devices share ranges, so check every earlier
+	//range that still reaches the page
+	for (lo--; lo >= 0 && dmi_ivals[lo].max_end >= page; lo--){
+		if (dmi_ivals[lo].end < page)
+			continue;
+		if (dmi_err_cnts[dmi_ivals[lo].dev]++){
+			if (found < 0)
 				found=0;
-			}else{
-				found = dmi_err_cnts[j] = 1;
-			}
+		}else{
+			found=1;
 		}
 	}
 	
@@ -1,6 +1,8 @@
 #ifndef __DMI_H__
 #define __DMI_H__
-int add_dmi_err(ulong adr);
+void init_dmi(void);
+int add_dmi_err(ulong page);
+int dmi_select(char *names);
 void print_dmi_err(void);
 void print_dmi_info(void);
 void print_dmi_startup_info(void);
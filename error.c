@@ -22,12 +22,29 @@ extern struct tseq tseq[];
 extern volatile int test;
 void poll_errors();
 extern int num_cpus;
+extern short triage;
+extern int smp_my_ord_num(int me);
+extern char ret_arm[];
+extern ulong ret_age;
+extern short ret_reported;
+extern int mix_test;
+extern short s_groups;
+extern volatile unsigned char s_grp[];
 
 static void update_err_counts(void);
 static void print_err_counts(void);
 static void common_err();
 static int syn, chan, len=1;
 
+/* The test of the calling CPU, the upper CPUs run mix_test with mix= */
+static int err_test(void)
+{
+    if (s_groups && s_grp[smp_my_cpu_num()] == 2) {
+        return mix_test;
+    }
+    return test;
+}
+
 static void paint_line(int msg_line, unsigned vga_color) {
     if (msg_line < 24) {
         char* pp;
@@ -82,6 +99,7 @@ void mt86_error(ulong *adr, ulong good, ulong bad)
 #endif
 
     common_err(adr, good, bad, xor, 0);
+    hot_add(page_of(adr));
     spin_unlock(&barr->mutex);
 }
 
@@ -121,7 +139,7 @@ static void update_err_counts(void)
                "                                            ");
     }
     ++(vv->ecount);
-    tseq[test].errors++;
+    tseq[err_test()].errors++;
 }
 
 static void print_err_counts(void)
@@ -141,6 +159,115 @@ static void print_err_counts(void)
     }
 }
 
+/* Append a string, a decimal or a hex number to a verdict line */
+static char *verdict_str(char *d, const char *s)
+{
+    while (*s) {
+        *d++ = *s++;
+    }
+    *d = 0;
+    return d;
+}
+
+static char *verdict_dec(char *d, const char *key, ulong val)
+{
+    char num[12];
+    int i;
+
+    d = verdict_str(d, key);
+    i = 0;
+    do {
+        num[i++] = val % 10 + '0';
+    } while ((val /= 10) > 0);
+    while (i) {
+        *d++ = num[--i];
+    }
+    *d = 0;
+    return d;
+}
+
+static char *verdict_hex(char *d, const char *key, ulong val)
+{
+    int i;
+
+    d = verdict_str(d, key);
+    d = verdict_str(d, "0x");
+    for (i = 28; i >= 0; i -= 4) {
+        *d++ = "0123456789abcdef"[(val >> i) & 0xf];
+    }
+    *d = 0;
+    return d;
+}
+
+/* Append the physical address of a failing word as 16 hex digits, the
+ * window address means nothing to the operator above the first 4GB */
+static char *verdict_adr(char *d, const char *key, ulong *adr)
+{
+    ulong page = page_of(adr);
+    int i;
+
+    d = verdict_hex(d, key, page >> 20);
+    page = page << 12 | ((ulong)adr & 0xfff);
+    for (i = 28; i >= 0; i -= 4) {
+        *d++ = "0123456789abcdef"[(page >> i) & 0xf];
+    }
+    *d = 0;
+    return d;
+}
+
+/*
+ * Report the result of a triage run as a single line on the screen
+ * and the serial console, e.g.
+ *
+ *   MEMTEST-TRIAGE verdict=FAIL test=3 pass=0 addr=0x... good=0x...
+ *   bad=0x... secs=42
+ *
+ * A failure halts all testing right away and leaves the result on
+ * screen, a pass returns so the caller can reboot.
+ */
+void triage_verdict(int fail, ulong *adr, ulong good, ulong bad)
+{
+    char line[128], *d;
+    ulong h, l, t = 0;
+
+    if (cpu_id.fid.bits.rdtsc) {
+        asm __volatile__("rdtsc":"=a" (l),"=d" (h));
+        asm __volatile__ (
+                          "subl %2,%0\n\t"
+                          "sbbl %3,%1"
+                          :"=a" (l), "=d" (h)
+                          :"g" (vv->startl), "g" (vv->starth),
+                           "0" (l), "1" (h));
+        t = h * ((unsigned)0xffffffff / vv->clks_msec) / 1000;
+        t += (l / vv->clks_msec) / 1000;
+    }
+
+    d = verdict_str(line, "MEMTEST-TRIAGE verdict=");
+    if (fail) {
+        d = verdict_str(d, "FAIL");
+        d = verdict_dec(d, " test=", test);
+        d = verdict_dec(d, " pass=", vv->pass);
+        d = verdict_adr(d, " addr=", adr);
+        d = verdict_hex(d, " good=", good);
+        d = verdict_hex(d, " bad=", bad);
+    } else {
+        d = verdict_str(d, "PASS");
+    }
+    d = verdict_dec(d, " secs=", t);
+
+    cprint(LINE_MSG, 0, line);
+    serial_echo_print("\n");
+    serial_echo_print(line);
+    serial_echo_print("\n");
+
+    if (fail) {
+        /* Keep the host out of service until someone looks at it */
+        while (1) {
+            asm __volatile__ ("cli; hlt");
+        }
+    }
+}
+
 /*
  * Print an individual error
  */
@@ -148,11 +275,19 @@ void common_err( ulong *adr, ulong good, ulong bad, ulong xor, int type)
 {
     int i, j, n, x, flag=0;
     ulong page, offset;
-    int patnchg;
+    int patnchg, dmi_new, ret;
     ulong mb;
 
     update_err_counts();
 
+    /* Count the error against the memory device it belongs to */
+    dmi_new = add_dmi_err(type >= 2 ? (ulong)adr : page_of(adr));
+
+    /* Triage stops at the first error */
+    if (triage) {
+        triage_verdict(1, adr, good, bad);
+    }
+
     switch(vv->printmode) {
     case PRINTMODE_SUMMARY:
         /* Don't do anything for a parity error. */
@@ -326,6 +461,16 @@ void common_err( ulong *adr, ulong good, ulong bad, ulong xor, int type)
         }
         /* Check for keyboard input */
         check_input();
+
+        /* Errors found while checking what the previous test left */
+        ret = type == 0 && ret_arm[smp_my_ord_num(smp_my_cpu_num())];
+        if (ret && !ret_reported) {
+            scroll();
+            cprint(vv->msg_line, 0, "Retention errors, pattern held for");
+            dprint(vv->msg_line, 35, ret_age, 6, 0);
+            cprint(vv->msg_line, 42, "s");
+            ret_reported = 1;
+        }
         scroll();
 	
         if ( type == 2 || type == 3) {
@@ -336,7 +481,10 @@ void common_err( ulong *adr, ulong good, ulong bad, ulong xor, int type)
             offset = ((unsigned long)adr) & 0xFFF;
         }
         mb = page >> 8;
-        dprint(vv->msg_line, 0, test+1, 3, 0);
+        dprint(vv->msg_line, 0, err_test()+1, 3, 0);
+        if (ret) {
+            cprint(vv->msg_line, 3, "R");
+        }
         dprint(vv->msg_line, 4, vv->pass, 5, 0);
         hprint(vv->msg_line, 11, page);
         hprint2(vv->msg_line, 19, offset, 3);
@@ -363,6 +511,9 @@ void common_err( ulong *adr, ulong good, ulong bad, ulong xor, int type)
         }
         vv->erri.eadr = (ulong)adr;
         print_err_counts();
+        if (dmi_new == 1) {
+            print_dmi_err();
+        }
         break;
 
     case PRINTMODE_PATTERNS:
@@ -371,7 +522,7 @@ void common_err( ulong *adr, ulong good, ulong bad, ulong xor, int type)
             vv->erri.hdr_flag++;
         }
         /* Do not do badram patterns from test 0 or 5 */
-        if (test == 0 || test == 5) {
+        if (err_test() == 0 || err_test() == 5) {
             return;
         }
         /* Only do patterns for data errors */
@@ -1095,6 +1095,7 @@ void get_mem_speed(int me, int ncpus)
 	}
 	
 	speed = memspeed(STEST_ADDR, i * 1024, 100);
+	spd[me] = speed;
 	cprint(5, 16, "       MB/s");
 	dprint(5, 16, speed, 6, 0);
 	
@@ -659,6 +659,7 @@ void check_input(void)
 void footer()
 {
     cprint(24, 0, "(ESC)exit  (c)configuration  (SP)scroll_lock  (CR)scroll_unlock");
+    cprint(24, 67, kernel_name());
     if (slock) {
         cprint(24, 74, "Locked");
     } else {
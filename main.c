@@ -16,6 +16,8 @@
 #include "cpuid.h"
 #include "smp.h"
 #include "config.h"
+#include "dmi.h"
+#include "io.h"
 #undef TEST_TIMES
 #define DEFTESTS 9
 #define FIRST_DIVISER 3
@@ -34,14 +36,14 @@ extern int	smp_my_ord_num(int me);
 extern int	smp_ord_to_cpu(int me);
 extern void	get_cpuid();
 extern void	initialise_cpus();
-extern ulong	rand(int cpu);
 extern void	get_mem_speed(int cpu, int ncpus);
-extern void	rand_seed(unsigned int seed1, unsigned int seed2, int cpu);
 extern struct	barrier_s *barr;
 extern int 	num_cpus;
 extern int 	act_cpus;
+extern short	dmi_initialized;
 
 static int	find_ticks_for_test(int test);
+static int	ticks_for_iter(int test, int iter, int ch);
 void		find_ticks_for_pass(void);
 int		find_chunks(int test);
 static void	test_setup(void);
@@ -60,6 +62,7 @@ struct tseq tseq[] =
      {1, 32,  9,  48, 0, "[Random number sequence]               "},
      {1, 32, 10,   6, 0, "[Modulo 20, Random pattern]            "},
      {1, 1,  11, 240, 0, "[Bit fade test, 2 patterns]            "},
+     {1, 32, 12,   3, 0, "[Random order line access]             "},
      {1, 0,   0,   0, 0, NULL}
 };
 
@@ -72,6 +75,10 @@ volatile short	cpu_mode;
 char		cpu_mask[MAX_CPUS];
 long 		bin_mask=0xffffffff;
 short		onepass;
+short		triage;			/* triage boot option, quick go/no-go */
+short		stripe_shift;		/* slice=stripe, log2 dwords, 0 = blocks */
+int		kern_force = -1;	/* kernel= boot option, -1 for auto */
+static char	*dimm_arg;		/* dimm= boot option */
 volatile short	btflag = 0;
 volatile int	test;
 short	        restart_flag;
@@ -96,11 +103,133 @@ volatile static ulong win0_start;	/* Start test address for window 0 */
 volatile static ulong win1_end;		/* End address for relocation */
 volatile static struct pmap winx;  	/* Window struct for mapping windows */
 
+/* Pass planner state, see budget_plan() */
+#define NUM_TSEQ	(sizeof(tseq)/sizeof(tseq[0]))
+static ulong	budget_ms;		/* budget= boot option, 0 = no plan */
+static ulong	plan_pass_start;	/* ms timestamp of the pass start */
+static ulong	plan_test_start;	/* ms timestamp of the test start */
+static short	plan_iter[NUM_TSEQ];	/* planned iterations, -1 = dropped */
+static ulong	plan_us[NUM_TSEQ];	/* measured us per tick, 0 = unknown */
+static void	budget_plan(int from);
+static void	budget_measure(int tst);
+static int	test_enabled(int tst);
+static void	first_test(void);
+static void	budget_show(void);
+static ulong	plan_now(void);
+static int	test_iter(int tst);
+
+/* Checkpoint state, see ckpt_save() */
+static short	ckpt_on;		/* resume boot option */
+static char	*ckpt_arg;		/* resume=<hex> boot option */
+static int	ckpt_reg = -1;		/* ckpt= CMOS offset, -1 = serial only */
+static void	ckpt_save(void);
+static int	ckpt_resume(void);
+static void	ckpt_credit(void);
+
+/* Yield ordered scheduling, see yield_order() */
+static short	sched_yield;		/* sched=yield boot option */
+static ulong	yield_seed[NUM_TSEQ];	/* yield= prior, errors per hour */
+static ulong	yield_ms[NUM_TSEQ];	/* total run time of each test */
+static short	yield_runs[NUM_TSEQ];	/* times each test ran */
+static char	yield_seq[NUM_TSEQ];	/* test order of this pass */
+static int	yield_n;		/* tests in yield_seq */
+static int	yield_pos;		/* current position in yield_seq */
+static void	yield_order(void);
+
+/* Hot-spot queue, see hot_add() */
+#define HOT_MAX		16
+#define HOT_ITER	8
+static ulong	hot_pages;		/* hotspot= region size, 0 = off */
+static ulong	hot_q[HOT_MAX];		/* region start pages */
+static int	hot_cnt;		/* regions queued */
+static int	hot_done;		/* regions already retested */
+static char	hot_tested[HOT_MAX];	/* hot_q entry was retested */
+static short	hot_active;
+static void	hot_retest(int me);
+
+/* Retention check state, see ret_final() */
+#define RET_WIN		1024
+static short	retention;		/* retention boot option */
+static char	ret_valid[RET_WIN];	/* window holds ret_pat */
+static ulong	ret_pat[RET_WIN];	/* pattern left by the last test */
+static ulong	ret_time[RET_WIN];	/* ms timestamp of ret_pat */
+static int	ret_key;		/* ret_* index of the current window */
+static short	ret_window;		/* current window is checked */
+static ulong	ret_plim[2];		/* test range ret_* are good for */
+static int	ret_final(ulong *pat);
+static void	ret_clear(void);
+static int	ret_moved(void);
+static int	ret_whole(void);
+extern char	ret_arm[];
+
+/* Bit fade overlap state, see fade_sched() */
+static short	fade_overlap;		/* bitfade=overlap boot option */
+static short	fade_live;		/* fade_half holds fade_pat */
+static int	fade_half;		/* 0 = lower, 1 = upper half */
+static ulong	fade_pat;		/* pattern left to fade */
+static ulong	fade_time;		/* ms timestamp of the fill */
+static ulong	fade_lim[2];		/* test range that is split */
+static ulong	fade_set[2];		/* test range we set last */
+static void	fade_sched(void);
+extern short	park_mwait;
+extern short	smt_mode;
+extern int	act_cores;
+static int	par_cpus(int tst);
+static int	bw_cpus;		/* CPUs that saturate memory, 0 = all */
+static short	bw_arg;			/* bwcpus= count, -1 = all */
+static void	bw_calibrate(int me);
+static void	spin_tune(void);
+static short	per_share;		/* percpu=share boot option */
+extern int	share_cpus, share_turn;
+static short	mix_on;			/* mix boot option */
+static int	mix_n;			/* CPUs running mix_test, 0 = none */
+int		mix_test;		/* test run next to the current one */
+static int	mix_pick(int tst);
+static ulong	rord_kb, rord_ms;	/* test #12 KB per CPU and time */
+static void	rord_show(void);
+extern int	slice_rot;
+extern volatile unsigned char s_grp[];
+extern short	s_groups;
+extern volatile unsigned char s_run[];
+extern int	bar_timeout;
+static int	ord_refresh(int me);
+extern ulong	ret_prev, ret_skip_lo, ret_skip_hi, ret_age;
+extern short	ret_reported;
+
 /* Find the next selected test to run */
 void next_test()
 {
+    int i;
+
+    /* Run the tests in the order chosen for this pass */
+    if (sched_yield) {
+        /* Only count a test that ran, not one skipped for lack of
+         * CPUs */
+        if (plan_test_start) {
+            yield_ms[test] += plan_now() - plan_test_start;
+            yield_runs[test]++;
+            plan_test_start = 0;
+        }
+        if (++yield_pos >= yield_n) {
+            pass_flag++;
+            yield_order();
+        }
+        test = yield_seq[yield_pos];
+        return;
+    }
+
+    /* Re-plan the rest of the pass with the time actually used */
+    if (budget_ms) {
+        budget_measure(test);
+        budget_plan(test+1);
+        vv->pass_ticks = vv->total_ticks;
+        for (i = test+1; tseq[i].cpu_sel != 0; i++) {
+            vv->pass_ticks += find_ticks_for_test(i);
+        }
+    }
+
     test++;
-    while (tseq[test].sel == 0 && tseq[test].cpu_sel != 0) {
+    while (!test_enabled(test) && tseq[test].cpu_sel != 0) {
         test++;
     }
 
@@ -108,10 +237,21 @@ void next_test()
         /* We hit the end of the list so we completed a pass */
         pass_flag++;
         /* Find the next test to run, start searching from 0 */
-        test = 0;
-        while (tseq[test].sel == 0 && tseq[test].cpu_sel != 0) {
-            test++;
-        }
+        first_test();
+    }
+}
+
+/* Find the first selected test of a pass */
+static void first_test(void)
+{
+    if (sched_yield) {
+        yield_order();
+        test = yield_seq[0];
+        return;
+    }
+    test = 0;
+    while (!test_enabled(test) && tseq[test].cpu_sel != 0) {
+        test++;
     }
 }
 
@@ -123,13 +263,16 @@ void set_defaults()
     if (start_seq == 2) {
         /* This is a restart so we reset everything */
         onepass = 0;
+        triage = 0;
         i = 0;
         while (tseq[i].cpu_sel) {
             tseq[i].sel = 1;
             i++;
         }
         test = 0;
-        if (tseq[0].sel == 0) {
+        if (sched_yield) {
+            first_test();
+        } else if (tseq[0].sel == 0) {
             next_test();
         }
     }
@@ -167,7 +310,10 @@ void set_defaults()
         tseq[i].errors = 0;
     }
     restart_flag = 0;
+    plan_test_start = 0;
+    ret_clear();
     tseq[10].sel = 0;
+    tseq[11].sel = 0;
 }
 
 /* Boot trace function */
@@ -260,6 +406,47 @@ switch_to_main_stack(unsigned cpu_num)
 #define OLD_CL_MAGIC 0xA33F 
 #define OLD_CL_OFFSET_ADDR ((unsigned short*) MK_PTR(INITSEG,0x22))
 
+/* Parse a physical address with an optional K, M, G or T suffix and
+ * return it as a page number, rounded up if 'up' is set */
+static ulong parse_page(char **cpp, int up)
+{
+    unsigned long long val = 0;
+    char *cp = *cpp;
+    int base = 10, n;
+
+    if (cp[0] == '0' && toupper(cp[1]) == 'X') {
+        base = 16;
+        cp += 2;
+    }
+    while (isxdigit(*cp)) {
+        n = mt86_isdigit(*cp) ? *cp-'0' : toupper(*cp)-'A'+10;
+        if (n >= base) {
+            break;
+        }
+        val = val * base + n;
+        cp++;
+    }
+    switch (toupper(*cp)) {
+    case 'T':
+        val <<= 10;
+        /* fall through */
+    case 'G':
+        val <<= 10;
+        /* fall through */
+    case 'M':
+        val <<= 10;
+        /* fall through */
+    case 'K':
+        val <<= 10;
+        cp++;
+    }
+    *cpp = cp;
+    if (up) {
+        val += 4095;
+    }
+    return val >> 12;
+}
+
 static void parse_command_line(void)
 {
     long simple_strtoul(char *cmd, char *ptr, int base);
@@ -304,6 +491,20 @@ static void parse_command_line(void)
             cp += 7;
             onepass++;
         }
+        /* Quick go/no-go check: sparse address test, a single fill and
+         * verify sweep and a page sampled random sequence, one pass,
+         * stop at the first error */
+        if (!mt86_strncmp(cp, "triage", 6)) {
+            cp += 6;
+            triage++;
+            onepass++;
+            k = 0;
+            while (tseq[k].cpu_sel) {
+                tseq[k].sel = (tseq[k].pat == 0 || tseq[k].pat == 3 ||
+                               tseq[k].pat == 9);
+                k++;
+            }
+        }
         /* Setup a list of tests to run */
         if (!mt86_strncmp(cp, "tstlist=", 8)) {
             cp += 8;
@@ -347,6 +548,162 @@ static void parse_command_line(void)
                 }
             }
         }
+        /* Plan each pass to fit in a number of minutes */
+        if (!mt86_strncmp(cp, "budget=", 7)) {
+            cp += 7;
+            budget_ms = simple_strtoul(cp, &dummy, 10) * 60000;
+        }
+        /* Continue an interrupted run and keep a checkpoint, either
+         * from CMOS or from a "MEMTEST-CKPT" serial line */
+        if (!mt86_strncmp(cp, "resume", 6)) {
+            cp += 6;
+            ckpt_on++;
+            if (*cp == '=') {
+                ckpt_arg = ++cp;
+            }
+        }
+        /* Also keep the checkpoint in the upper CMOS bank at this
+         * offset, only where the firmware is known not to use it */
+        if (!mt86_strncmp(cp, "ckpt=", 5)) {
+            cp += 5;
+            ckpt_reg = simple_strtoul(cp, &dummy, 16);
+        }
+        /* Lists of physical ranges to test only or to skip, as
+         * <start>-<end>[,<start>-<end>...] */
+        if (!mt86_strncmp(cp, "include=", 8) ||
+            !mt86_strncmp(cp, "exclude=", 8)) {
+            k = (*cp == 'e');
+            cp += 8;
+            while (*cp && *cp != ' ') {
+                ulong start = parse_page(&cp, 0);
+                if (*cp != '-') {
+                    break;
+                }
+                cp++;
+                mem_range_add(k, start, parse_page(&cp, 1));
+                if (*cp != ',') {
+                    break;
+                }
+                cp++;
+            }
+        }
+        /* Only test the memory of the listed DIMMs, by DMI locator */
+        if (!mt86_strncmp(cp, "dimm=", 5)) {
+            cp += 5;
+            dimm_arg = cp;
+        }
+        /* Order the tests of each pass by the errors they found */
+        if (!mt86_strncmp(cp, "sched=yield", 11)) {
+            cp += 11;
+            sched_yield++;
+        }
+        /* Prior errors per hour of each test, as <test>:<rate>,... */
+        if (!mt86_strncmp(cp, "yield=", 6)) {
+            cp += 6;
+            sched_yield++;
+            while (mt86_isdigit(*cp)) {
+                i = simple_strtoul(cp, &dummy, 10);
+                while (mt86_isdigit(*cp)) cp++;
+                if (*cp++ != ':') {
+                    break;
+                }
+                if (i < NUM_TSEQ) {
+                    yield_seed[i] = simple_strtoul(cp, &dummy, 10);
+                }
+                while (mt86_isdigit(*cp)) cp++;
+                if (*cp != ',') {
+                    break;
+                }
+                cp++;
+            }
+        }
+        /* Retest the region around failing pages right away */
+        if (!mt86_strncmp(cp, "hotspot", 7)) {
+            cp += 7;
+            hot_pages = 512;		/* 2 MB */
+            if (*cp == '=') {
+                cp++;
+                i = simple_strtoul(cp, &dummy, 10) / 4;
+                for (hot_pages = 1; hot_pages < i; hot_pages <<= 1)
+                    ;
+            }
+        }
+        /* Use all SMT threads for the parallel tests, or none */
+        if (!mt86_strncmp(cp, "smt=", 4)) {
+            cp += 4;
+            if (!mt86_strncmp(cp, "on", 2)) {
+                smt_mode = 1;
+            } else if (!mt86_strncmp(cp, "off", 3)) {
+                smt_mode = -1;
+            }
+        }
+        /* Give the CPUs interleaved stripes of memory, 4K to 2M */
+        if (!mt86_strncmp(cp, "slice=stripe", 12)) {
+            cp += 12;
+            i = 1;
+            if (*cp == ':') {
+                cp++;
+                for (j = parse_page(&cp, 1); i < j && i < 512; i <<= 1)
+                    ;
+            }
+            for (stripe_shift = 10; i > 1; i >>= 1) {
+                stripe_shift++;
+            }
+        }
+        /* Number of CPUs for the bandwidth bound tests */
+        if (!mt86_strncmp(cp, "bwcpus=", 7)) {
+            cp += 7;
+            if (!mt86_strncmp(cp, "all", 3)) {
+                cp += 3;
+                bw_arg = -1;
+            } else {
+                bw_arg = simple_strtoul(cp, &dummy, 10);
+            }
+        }
+        /* Split the tests that run on each CPU in turn between them */
+        if (!mt86_strncmp(cp, "percpu=share", 12)) {
+            cp += 12;
+            per_share = 1;
+        }
+        /* Run a second test on part of the CPUs and memory */
+        if (!mt86_strncmp(cp, "mix", 3)) {
+            cp += 3;
+            mix_on = 1;
+            s_groups = 1;
+        }
+        /* Drop a CPU that is stuck for this many seconds */
+        if (!mt86_strncmp(cp, "bartimeout=", 11)) {
+            cp += 11;
+            bar_timeout = simple_strtoul(cp, &dummy, 10);
+        }
+        /* Park idle CPUs with MWAIT in the deepest C-state */
+        if (!mt86_strncmp(cp, "park=mwait", 10)) {
+            cp += 10;
+            park_mwait = 1;
+        }
+        /* Let the bit fade test fade while other tests run */
+        if (!mt86_strncmp(cp, "bitfade=overlap", 15)) {
+            cp += 15;
+            fade_overlap = 1;
+        }
+        /* Check what the last test left while filling the next one */
+        if (!mt86_strncmp(cp, "retention", 9)) {
+            cp += 9;
+            retention = 1;
+        }
+        /* Force a test kernel variant */
+        if (!mt86_strncmp(cp, "kernel=", 7)) {
+            cp += 7;
+            if (!mt86_strncmp(cp, "i486", 4)) {
+                kern_force = KERN_I486;
+            } else if (!mt86_strncmp(cp, "sse2", 4)) {
+                kern_force = KERN_SSE2;
+            } else if (!mt86_strncmp(cp, "avx2", 4)) {
+                kern_force = KERN_AVX2;
+            } else if (!mt86_strncmp(cp, "avx512", 6)) {
+                kern_force = KERN_AVX512;
+            }
+        }
         /* go to the next parameter */
         while (*cp && *cp != ' ') cp++;
         while (*cp == ' ') cp++;
@@ -378,7 +735,7 @@ void clear_screen()
  * we relocate. */
 void test_start(void)
 {
-    int my_cpu_num, my_cpu_ord, run;
+    int my_cpu_num, my_cpu_ord, run, rc;
 
     /* If this is the first time here we are CPU 0 */
     if (start_seq == 0) {
@@ -433,16 +790,41 @@ void test_start(void)
              *  reserved for locks */
             vv->pmap[0].end--;
 
+            /* Index the DMI memory devices for error attribution */
+            if (!dmi_initialized) {
+                init_dmi();
+            }
+
+            /* Apply the dimm=, include= and exclude= ranges */
+            if (dimm_arg && dmi_select(dimm_arg) == 0) {
+                cprint(LINE_MSG, COL_MSG-8,
+                       "No memory device mapping matches dimm=");
+            }
+            pmap_ranges();
+
             find_ticks_for_pass();
+
+            /* The budget planner needs the tests in their fixed order */
+            if (budget_ms) {
+                sched_yield = 0;
+            }
+            if (sched_yield) {
+                first_test();
+            }
+
+            /* Pick up where an interrupted run left off */
+            if (ckpt_on && ckpt_resume()) {
+                ckpt_on = 2;
+            }
         } else {
             /* APs only, Register the APs */
             btrace(my_cpu_num, __LINE__, "AP_Start  ", 0, my_cpu_num,
                    cpu_ord);
             smp_ap_booted(my_cpu_num);
-            /* Asign a sequential CPU ordinal to each active cpu */
+            /* The ordinal was assigned by topology, see smp_select() */
             spin_lock(&barr->mutex);
-            my_cpu_ord = cpu_ord++;
-            smp_set_ordinal(my_cpu_num, my_cpu_ord);
+            cpu_ord++;
+            my_cpu_ord = smp_my_ord_num(my_cpu_num);
             spin_unlock(&barr->mutex);
             btrace(my_cpu_num, __LINE__, "AP_Done   ", 0, my_cpu_num,
                    my_cpu_ord);
@@ -484,6 +866,38 @@ void test_start(void)
                  : :
                  : "ax"
                  );
+        /* Enable the AVX and AVX-512 register state for the SIMD test
+         * kernels */
+        if (cpu_id.fid.bits.xsave) {
+            ulong xcr0 = 0x3;
+            /* XSETBV faults on a partial AVX-512 state or one without
+             * the AVX state, hypervisors often hide some of it */
+            if (cpu_id.fid.bits.avx && (cpu_id.xcr0_mask & 0x4)) {
+                xcr0 |= 0x4;
+                if (cpu_id.efid.bits.avx512f &&
+                    (cpu_id.xcr0_mask & 0xe6) == 0xe6) {
+                    xcr0 |= 0xe0;
+                }
+            }
+            xcr0 &= cpu_id.xcr0_mask | 0x1;
+            __asm__ __volatile__
+                (
+                 "movl %%cr4, %%eax\n\t"
+                 "orl $0x00040000, %%eax\n\t"
+                 "movl %%eax, %%cr4\n\t"
+                 "xorl %%ecx, %%ecx\n\t"
+                 "xorl %%edx, %%edx\n\t"
+                 "movl %0, %%eax\n\t"
+                 "xsetbv\n\t"
+                 : : "r" (xcr0)
+                 : "ax", "cx", "dx"
+                 );
+        }
+        /* Pick the test kernels once the BSP has its state enabled */
+        if (my_cpu_num == 0) {
+            kernel_select(kern_force);
+            footer();
+        }
 
         btrace(my_cpu_num, __LINE__, "Mem Mgmnt ",
                1, cpu_id.fid.bits.pae, cpu_id.fid.bits.lm);
@@ -515,6 +929,31 @@ void test_start(void)
         }
         /* Get the memory Speed with all CPUs */
         get_mem_speed(my_cpu_num, num_cpus);
+
+        /* Find how many CPUs it takes to saturate the memory */
+        bw_calibrate(my_cpu_ord);
+
+        /* Now that the memory speed is known size the chunks and plan
+         * the first pass */
+        if (my_cpu_num == 0) {
+            spin_tune();
+            find_ticks_for_pass();
+            if (ckpt_on == 2) {
+                ckpt_credit();
+            }
+
+            /* Salt the random test patterns once per boot */
+            if (cpu_id.fid.bits.rdtsc) {
+                asm __volatile__ ("rdtsc":"=a" (pat_seed)::"edx");
+            }
+        }
+        if (budget_ms && my_cpu_num == 0) {
+            budget_show();
+            if (ckpt_on != 2) {
+                first_test();
+            }
+            plan_pass_start = plan_now();
+        }
     }
 
     /* Set the initialized flag only after all of the CPU's have
@@ -533,10 +972,19 @@ void test_start(void)
         /* Skip single CPU tests if we are using only one CPU */
         if (tseq[test].cpu_sel == -1 && 
             (num_cpus == 1 || cpu_mode != CPM_ALL)) {
-            test++;
+            if (sched_yield) {
+                next_test();
+            } else {
+                test++;
+            }
             continue;
         }
 
+        /* Keep the other tests off the half that is fading */
+        if (fade_overlap && my_cpu_ord == mstr_cpu) {
+            fade_sched();
+        }
+
         test_setup();
 
         /* Loop through all possible windows */
@@ -546,6 +994,7 @@ void test_start(void)
             cprint(8, my_cpu_num+7, "W");
             btrace(my_cpu_num, __LINE__, "Sched_Barr", 1,window,win_next);
             barrier();
+            my_cpu_ord = ord_refresh(my_cpu_num);
 
             /* Don't go over the 8TB PAE limit */
             if (win_next > MAX_MEM_PAGES) {
@@ -575,6 +1024,7 @@ void test_start(void)
             btrace(my_cpu_num, __LINE__, "Sched_CPU0",1,cpu_sel,
                    tseq[test].cpu_sel);
             run = 1;
+            mix_n = 0;
             switch(cpu_mode) {
             case CPM_RROBIN:
             case CPM_SEQ:
@@ -599,17 +1049,19 @@ void test_start(void)
                 } else {
                     /* Use the number of CPUs specified by the test,
                      * Starting with zero */
-                    if (my_cpu_ord >= tseq[test].cpu_sel) {
+                    if (my_cpu_ord >= par_cpus(test)) {
                         run = 0;
                     }
                     /* Set the master CPU to the highest CPU number 
                      * that has been selected */
-                    if (act_cpus < tseq[test].cpu_sel) {
-                        mstr_cpu = act_cpus-1;
-                        run_cpus = act_cpus;
-                    } else {
-                        mstr_cpu = tseq[test].cpu_sel-1;
-                        run_cpus = tseq[test].cpu_sel;
+                    mstr_cpu = par_cpus(test)-1;
+                    run_cpus = par_cpus(test);
+                    /* With mix the upper CPUs run another test, not
+                     * in window 0 where the image is relocated */
+                    if (mix_on && window != 0 && run_cpus > 1 &&
+                        (mix_test = mix_pick(test)) >= 0) {
+                        mix_n = run_cpus / 2;
+                        mstr_cpu = run_cpus - mix_n - 1;
                     }
                 }
             }
@@ -620,10 +1072,14 @@ void test_start(void)
             /* Setup a sub barrier for only the selected CPUs */
             if (my_cpu_ord == mstr_cpu) {
                 s_barrier_init(run_cpus);
+                if (mix_n) {
+                    s_barrier_split(run_cpus - mix_n, mix_n);
+                }
             }
 
             /* Make sure the the sub barrier is ready before proceeding */
             barrier();
+            s_run[my_cpu_num] = run;
 
             /* Not selected CPUs go back to the scheduling barrier */
             if (run == 0 ) {
@@ -633,6 +1089,9 @@ void test_start(void)
             btrace(my_cpu_num, __LINE__, "Sched_Win0",1,window,win_next);
 
             if (my_cpu_ord == mstr_cpu) {
+                if (ckpt_on) {
+                    ckpt_save();
+                }
                 switch (window) {
 		    /* Special case for relocation */
                 case 0:
@@ -658,6 +1117,41 @@ void test_start(void)
 
                 /* Find the memory areas to test */
                 segs = compute_segments(winx, my_cpu_num);
+
+                /* With percpu=share each turn of a test that runs on
+                 * every CPU takes a share of the memory, rotating with
+                 * the pass so every CPU sees all of it in time */
+                share_cpus = 0;
+                if (per_share && cpu_mode == CPM_ALL &&
+                    tseq[test].cpu_sel == -1) {
+                    share_cpus = act_cpus;
+                    share_turn = (cpu_sel + vv->pass) % act_cpus;
+                }
+
+                /* The two mix groups swap halves every other pass */
+                slice_rot = mix_n && (vv->pass & 1) ? mix_n : 0;
+
+                /* Arm the retention check if we know what this window
+                 * holds.  Window 1 shares memory with window 0 and with
+                 * the relocated image, don't check those parts. */
+                if (ret_moved()) {
+                    ret_clear();
+                }
+                ret_key = winx.start == 0 ? 0 :
+                    winx.start / WIN_SZ_PAGES + 1;
+                ret_window = retention && ret_key > 0 &&
+                    ret_key < RET_WIN && ret_valid[ret_key];
+                if (ret_window) {
+                    ret_prev = ret_pat[ret_key];
+                    ret_age = (plan_now() - ret_time[ret_key]) / 1000;
+                    ret_reported = 0;
+                    ret_skip_lo = 0;
+                    ret_skip_hi = 0;
+                    if (ret_key == 1) {
+                        ret_skip_hi = (high_test_adr +
+                            ((_end - _start + 4095) & ~4095)) >> 2;
+                    }
+                }
             }
             s_barrier();
             btrace(my_cpu_num,__LINE__,"Sched_Win2",1,segs,
@@ -676,15 +1170,30 @@ void test_start(void)
 
             btrace(my_cpu_num, __LINE__, "Strt_Test ",1,my_cpu_num,
                    my_cpu_ord);
-            do_test(my_cpu_ord);
+            ret_arm[my_cpu_ord] = ret_window;
+            phase_forget(my_cpu_ord);
+            if (mix_n) {
+                s_grp[my_cpu_num] = my_cpu_ord < run_cpus - mix_n ? 1 : 2;
+            }
+            rc = do_test(my_cpu_ord);
+            s_grp[my_cpu_num] = 0;
+            ret_arm[my_cpu_ord] = 0;
             btrace(my_cpu_num, __LINE__, "End_Test  ",1,my_cpu_num,
                    my_cpu_ord);
 
+            /* Remember what the test left in this window */
+            if (retention && my_cpu_ord == mstr_cpu && ret_key < RET_WIN) {
+                ret_valid[ret_key] = rc == 0 && mix_n == 0 &&
+                    ret_whole() && ret_final(&ret_pat[ret_key]);
+                ret_time[ret_key] = plan_now();
+            }
+
             paging_off();
 
         } /* End of window loop */
 
         s_barrier();
+        my_cpu_ord = ord_refresh(my_cpu_num);
         btrace(my_cpu_num, __LINE__, "End_Win   ",1,test, window);
 
         /* Setup for the next set of windows */
@@ -697,8 +1206,27 @@ void test_start(void)
             continue;
         }
 
+        /* Random access rate of test #12 */
+        if (rord_ms) {
+            rord_show();
+        }
+
         /* Special handling for the bit fade test #11 */
-        if (tseq[test].pat == 11 && bitf_seq != 6) {
+        if (tseq[test].pat == 11 && fade_overlap) {
+            if (bitf_seq == 0) {
+                /* Checked, now fill the other half */
+                fade_live = 0;
+                fade_half ^= 1;
+                if (fade_half == 0) {
+                    fade_pat = ~fade_pat;
+                }
+                bitf_seq = 1;
+                continue;
+            }
+            fade_live = 1;
+            fade_time = plan_now();
+            bitf_seq = 0;
+        } else if (tseq[test].pat == 11 && bitf_seq != 6) {
             /* Keep going until the sequence is complete. */
             bitf_seq++;
             continue;
@@ -706,6 +1234,11 @@ void test_start(void)
             bitf_seq = 0;
         }
 
+        /* Look closer at any failing regions before moving on */
+        if (hot_done < hot_cnt) {
+            hot_retest(my_cpu_ord);
+        }
+
         /* Select advancement of CPUs and next test */
         switch(cpu_mode) {
         case CPM_RROBIN:
@@ -745,13 +1278,19 @@ void test_start(void)
             vv->pass++;
 			
             dprint(LINE_INFO, 49, vv->pass, 5, 0);
+            plan_pass_start = plan_now();
             find_ticks_for_pass();
             ltest = -1;
+            /* The new plan may start the pass with another test */
+            if (budget_ms) {
+                first_test();
+            }
 			
             if (vv->ecount == 0) 
             {
                 /* If onepass is enabled and we did not get any errors
                  * reboot to exit the test */
+                if (triage) {	triage_verdict(0, 0, 0, 0);   }
                 if (onepass) {	reboot();   }
                 if (!btflag)
                     cprint(LINE_MSG, COL_MSG-8,
@@ -772,26 +1311,20 @@ void test_start(void)
 
 void test_setup()
 {
-    static int ltest = -1;
-
     /* See if a specific test has been selected */
     if (vv->testsel >= 0) {
         test = vv->testsel;
     }
 
-    /* Only do the setup if this is a new test */
+    /* Only do the setup if this is a new test, or the first one of a
+     * pass, ltest is reset at the end of each pass */
     if (test == ltest) {
         return;
     }
     ltest = test;
 
     /* Now setup the test parameters based on the current test number */
-    if (vv->pass == 0) {
-        /* Reduce iterations for first pass */
-        c_iter = tseq[test].iter/FIRST_DIVISER;
-    } else {
-        c_iter = tseq[test].iter;
-    }
+    c_iter = test_iter(test);
 
     /* Set the number of iterations. We only do half of the iterations */
     /* on the first pass */
@@ -799,6 +1332,7 @@ void test_setup()
     test_ticks = find_ticks_for_test(test);
     nticks = 0;
     vv->tptr = 0;
+    plan_test_start = plan_now();
 
     cprint(LINE_PAT, COL_PAT, "            ");
     cprint(LINE_PAT, COL_PAT-3, "   ");
@@ -807,14 +1341,18 @@ void test_setup()
     cprint(2, COL_MID+8, "                                         ");
 }
 
-/* A couple static variables for when all cpus share the same pattern */
-static ulong sp1, sp2;
-
 int do_test(int my_ord)
 {
     int i=0, j=0;
     static int bitf_sleep;
     unsigned long p0=0, p1=0, p2=0;
+    int tst = test, iter = c_iter;
+
+    /* The mix group runs one iteration of its own test */
+    if (mix_n && my_ord >= run_cpus - mix_n) {
+        tst = mix_test;
+        iter = 1;
+    }
 
     if (my_ord == mstr_cpu) {
         if ((ulong)&_start > LOW_TEST_ADR) {
@@ -843,7 +1381,7 @@ int do_test(int my_ord)
         aprint(LINE_RANGE, COL_MID+34, vv->selected_pages);
     }
 
-    switch(tseq[test].pat) {
+    switch(tseq[tst].pat) {
 
 	/* do the testing according to the selected pattern */
 
@@ -863,102 +1401,127 @@ int do_test(int my_ord)
 
     case 3:
     case 4:	/* Moving inversions, all ones and zeros (tests #3, 4) */
+        /* The sliced tests below make up every pattern locally and
+         * only touch this CPU's slice, so after one barrier to pick up
+         * the master's segment update each CPU runs its phases straight
+         * through, held back only by the tick barriers */
+        s_barrier();
+        if (triage && tseq[tst].pat == 3) {
+            /* Just one fill and verify sweep */
+            fill_verify(0x5555aaaa, my_ord);
+            BAILOUT;
+            break;
+        }
         p1 = 0;
         p2 = ~p1;
-        s_barrier();
-        movinv1(c_iter,p1,p2,my_ord);
+        movinv1(iter,p1,p2,my_ord);
         BAILOUT;
 
         /* Switch patterns */
-        s_barrier();
-        movinv1(c_iter,p2,p1,my_ord);
+        movinv1(iter,p2,p1,my_ord);
         BAILOUT;
         break;
 
     case 5: /* Moving inversions, 8 bit walking ones and zeros (test #5) */
+        s_barrier();
         p0 = 0x80;
         for (i=0; i<8; i++, p0=p0>>1) {
             p1 = p0 | (p0<<8) | (p0<<16) | (p0<<24);
             p2 = ~p1;
-            s_barrier();
-            movinv1(c_iter,p1,p2, my_ord);
+            movinv1(iter,p1,p2, my_ord);
             BAILOUT;
 	
             /* Switch patterns */
-            s_barrier();
-            movinv1(c_iter,p2,p1, my_ord);
+            movinv1(iter,p2,p1, my_ord);
             BAILOUT;
         }
         break;
 		
     case 6: /* Random Data (test #6) */
-        /* Seed the random number generator */
-        if (my_ord == mstr_cpu) {
-            if (cpu_id.fid.bits.rdtsc) {
-                asm __volatile__ ("rdtsc":"=a" (sp1),"=d" (sp2));
-            } else {
-                sp1 = 521288629 + vv->pass;
-                sp2 = 362436069 - vv->pass;
-            }
-            rand_seed(sp1, sp2, 0);
-        }
-
         s_barrier();
-        for (i=0; i < c_iter; i++) {
-            if (my_ord == mstr_cpu) {
-                sp1 = rand(0);
-                sp2 = ~p1;
-            }
-            s_barrier();
-            movinv1(2,sp1,sp2, my_ord);
+        for (i=0; i < iter; i++) {
+            p1 = test_pat(tst, i);
+            p2 = ~p1;
+            movinv1(2,p1,p2, my_ord);
             BAILOUT;
         }
         break;
 
 
     case 7: /* Block move (test #7) */
-        block_move(c_iter, my_ord);
+        block_move(iter, my_ord);
         BAILOUT;
         break;
 
     case 8: /* Moving inversions, 32 bit shifting pattern (test #8) */
+        s_barrier();
         for (i=0, p1=1; p1; p1=p1<<1, i++) {
-            s_barrier();
-            movinv32(c_iter,p1, 1, 0x80000000, 0, i, my_ord);
+            movinv32(iter,p1, 1, 0x80000000, 0, i, my_ord);
             { BAILOUT }
-            s_barrier();
-            movinv32(c_iter,~p1, 0xfffffffe,
+            movinv32(iter,~p1, 0xfffffffe,
                      0x7fffffff, 1, i, my_ord);
             { BAILOUT }
         }
         break;
 
     case 9: /* Random Data Sequence (test #9) */
-        for (i=0; i < c_iter; i++) {
-            s_barrier();
-            movinvr(my_ord);
+        s_barrier();
+        for (i=0; i < iter; i++) {
+            movinvr(test_pat(tst, i), my_ord);
             BAILOUT;
         }
         break;
 
     case 10: /* Modulo 20 check, Random pattern (test #10) */
-        for (j=0; j<c_iter; j++) {
-            p1 = rand(0);
+        s_barrier();
+        for (j=0; j<iter; j++) {
+            p1 = test_pat(tst, j);
             for (i=0; i<MOD_SZ; i++) {
                 p2 = ~p1;
-                s_barrier();
                 modtst(i, 2, p1, p2, my_ord);
                 BAILOUT;
 
                 /* Switch patterns */
-                s_barrier();
                 modtst(i, 2, p2, p1, my_ord);
                 BAILOUT;
             }
         }
         break;
 
+    case 12: /* Random order line access (test #12) */
+        s_barrier();
+        p0 = plan_now();
+        for (i=0; i < iter; i++) {
+            p1 = rand_order(test_pat(tst, i), my_ord);
+            if (my_ord == mstr_cpu) {
+                rord_kb += p1 >> 4;
+            }
+            BAILOUT;
+        }
+        if (my_ord == mstr_cpu) {
+            rord_ms += plan_now() - p0;
+        }
+        break;
+
     case 11: /* Bit fade test, fill (test #11) */
+        if (fade_overlap) {
+            /* Check the half filled last time, then fill the other */
+            if (bitf_seq == 0 && fade_live) {
+                if (bitf_sleep) {
+                    i = iter - (plan_now() - fade_time) / 1000;
+                    if (i > 0) {
+                        sleep(i, 1, my_ord, 0);
+                    }
+                    bitf_sleep = 0;
+                }
+                bit_fade_chk(fade_pat, my_ord);
+            } else if (bitf_seq == 1) {
+                bit_fade_fill(fade_pat, my_ord);
+                bitf_sleep = 1;
+            }
+            BAILOUT;
+            break;
+        }
         /* Use a sequence to process all windows for each stage */
         switch(bitf_seq) {
         case 0:	/* Fill all of memory 0's */
@@ -968,7 +1531,7 @@ int do_test(int my_ord)
         case 1: /* Sleep for the specified time */
             /* Only sleep once */
             if (bitf_sleep) {
-                sleep(c_iter, 1, my_ord, 0);
+                sleep(iter, 1, my_ord, 0);
                 bitf_sleep = 0;
             }
             break;
@@ -982,7 +1545,7 @@ int do_test(int my_ord)
         case 4: /* Sleep for the specified time */
             /* Only sleep once */
             if (bitf_sleep) {
-                sleep(c_iter, 1, my_ord, 0);
+                sleep(iter, 1, my_ord, 0);
                 bitf_sleep = 0;
             }
             break;
@@ -997,13 +1560,13 @@ int do_test(int my_ord)
         p1=0;
         for (i=0; i<MOD_SZ; i++) {
             p2 = ~p1;
-            modtst(i, c_iter, p1, p2, my_ord);
+            modtst(i, iter, p1, p2, my_ord);
             BAILOUT;
 
             /* Switch patterns */
             p2 = p1;
             p1 = ~p2;
-            modtst(i, c_iter, p1,p2, my_ord);
+            modtst(i, iter, p1,p2, my_ord);
             BAILOUT;
         }
         break;
@@ -1014,13 +1577,13 @@ int do_test(int my_ord)
             p1 = p0 | (p0<<8) | (p0<<16) | (p0<<24);
             for (i=0; i<MOD_SZ; i++) {
                 p2 = ~p1;
-                modtst(i, c_iter, p1, p2, my_ord);
+                modtst(i, iter, p1, p2, my_ord);
                 BAILOUT;
 
                 /* Switch patterns */
                 p2 = p1;
                 p1 = ~p2;
-                modtst(i, c_iter, p1, p2, my_ord);
+                modtst(i, iter, p1, p2, my_ord);
                 BAILOUT;
             }
         }
@@ -1029,16 +1592,16 @@ int do_test(int my_ord)
     return(0);
 }
 
-/* Compute number of SPINSZ_DWORDS chunks being tested */
+/* Compute number of spin_dw chunks being tested */
 int find_chunks(int tst) 
 {
-    int i, j, sg, wmax, ch;
+    int i, j, sg, wmax, ch, n, shrt;
     struct pmap twin={0,0};
     unsigned long wnxt = WIN_SZ_PAGES;
     unsigned long len;
 
     wmax = MAX_MEM_PAGES/WIN_SZ_PAGES+2;  /* The number of 2 GB segments +2 */
-    /* Compute the number of SPINSZ_DWORDS memory segments */
+    /* Compute the number of spin_dw memory segments */
     ch = 0;
     for(j = 0; j < wmax; j++) {
         /* special case for relocation */
@@ -1062,83 +1625,358 @@ int find_chunks(int tst)
 
         /* Find the memory areas I am going to test */
         sg = compute_segments(twin, -1);
-        for(i = 0; i < sg; i++) {
+        for(i = 0, shrt = 0; i < sg; i++) {
             len = vv->map[i].end - vv->map[i].start;
 
+            n = 1;
             if (cpu_mode == CPM_ALL && num_cpus > 1) {
                 switch(tseq[tst].pat) {
                 case 2:
+                case 3:
                 case 4:
                 case 5:
                 case 6:
                 case 9:
                 case 10:
-                    len /= act_cpus;
+                case 12:
+                    n = par_cpus(tst);
                     break;
                 case 7:
                 case 8:
-                    len /= act_cpus;
+                    n = act_cpus;
                     break;
                 }
             }
-            ch += (len + SPINSZ_DWORDS -1)/SPINSZ_DWORDS;
+            /* Short segments share a single tick, see
+             * short_foreach_segment() */
+            if (len < n * SHORT_SEG_DW - 1) {
+                shrt = 1;
+                continue;
+            }
+            len /= n;
+            ch += (len + spin_dw - 1) / spin_dw;
         }
+        ch += shrt;
     }
     return(ch);
 }
 
-/* Compute the total number of ticks per pass */
-void find_ticks_for_pass(void)
+/* Get our ordinal again, a CPU dropped by a barrier timeout moves the
+ * ones above it down, and keep the CPU picks inside the CPUs left */
+static int ord_refresh(int me)
 {
-    int i;
+    if (cpu_sel >= act_cpus) {
+        cpu_sel = 0;
+    }
+    if (mstr_cpu >= act_cpus) {
+        mstr_cpu = act_cpus - 1;
+    }
+    return smp_my_ord_num(me);
+}
 
-    vv->pptr = 0;
-    vv->pass_ticks = 0;
-    vv->total_ticks = 0;
-    cprint(1, COL_MID+8, "                                         ");
-    i = 0;
-    while (tseq[i].cpu_sel != 0) {
-        /* Skip tests 2 and 4 if we are using 1 cpu */
-        if (act_cpus == 1 && (i == 2 || i == 4)) { 
-            i++;
-            continue;
+/*
+ * Number of CPUs a test with a CPU count runs on.  The ordinals put the
+ * first thread of every core before any SMT sibling, so unless smt=on
+ * the streaming tests run one thread per core.  The tests that only
+ * stream through memory stop at the CPU count that saturates it, the
+ * random and modulo 20 tests are bound by latency and use them all.
+ */
+static int par_cpus(int tst)
+{
+    int n = act_cpus;
+
+    if (smt_mode <= 0 && n > act_cores) {
+        n = act_cores;
+    }
+    switch (tseq[tst].pat) {
+    case 2:
+    case 3:
+    case 5:
+    case 6:
+    case 7:
+        if (bw_cpus > 0 && n > bw_cpus) {
+            n = bw_cpus;
         }
-        vv->pass_ticks += find_ticks_for_test(i);
-        i++;
+        break;
+    }
+    if (n > tseq[tst].cpu_sel) {
+        n = tseq[tst].cpu_sel;
     }
+    return n;
 }
 
-static int find_ticks_for_test(int tst)
+/*
+ * Bandwidth sweep for the bwcpus boot option.
+ *
+ * At startup all CPUs fill a private buffer BW_REPS times, first with
+ * one CPU and then with 2, 4 ... up to one per core.  The ordinals go
+ * round the packages first, so every step loads the memory controllers
+ * evenly.  The knee is the first count within 10% of the best
+ * bandwidth, adding CPUs past it only adds barrier overhead for the
+ * streaming tests.  The buffers come from the largest block between
+ * 1 MB and 2 GB, our image is still below 1 MB.
+ */
+#define BW_PTS		8
+#define BW_REPS		4
+#define BW_MAX_PAGES	4096			/* 16 MB per CPU */
+
+static volatile ulong	bw_base, bw_len;	/* pages */
+static volatile int	bw_max;
+static int		bw_pts;
+static short		bw_n[BW_PTS];
+static ulong		bw_mbs[BW_PTS];
+
+/* Microseconds since the TSC read l:h, the runs are only a few ms long */
+static ulong bw_us(ulong l, ulong h)
 {
-    int ticks=0, iter, ch;
+    ulong clks_us = vv->clks_msec / 1000;
+
+    asm __volatile__ (
+                      "rdtsc\n\t"
+                      "subl %2,%%eax\n\t"
+                      "sbbl %3,%%edx"
+                      :"=&a" (l), "=&d" (h)
+                      :"g" (l), "g" (h));
+    return h * ((unsigned)0xffffffff / clks_us) + l / clks_us;
+}
 
-    if (tseq[tst].sel == 0) {
-        return(0);
+static void bw_show(void)
+{
+    char line[96];
+    int i, k, row = LINE_SCROLL + (budget_ms ? 5 : 0);
+
+    cprint(row, 0, "CPUs:MB/s");
+    cprint(row+1, 0, "Streaming CPUs:");
+    for (k = 0; k < bw_pts; k++) {
+        dprint(row, 12+11*k, bw_n[k], 2, 0);
+        cprint(row, 14+11*k, ":");
+        dprint(row, 15+11*k, bw_mbs[k], 6, 0);
+    }
+    dprint(row+1, 16, bw_cpus, 3, 0);
+
+    for (i = 0; i < 10; i++) {
+        line[i] = "MEMTEST-BW"[i];
+    }
+    for (k = 0; k < bw_pts; k++) {
+        line[i++] = ' ';
+        itoa(line + i, bw_n[k]);
+        while (line[i]) {
+            i++;
+        }
+        line[i++] = ':';
+        itoa(line + i, bw_mbs[k]);
+        while (line[i]) {
+            i++;
+        }
+    }
+    for (k = 0; k < 6; k++) {
+        line[i++] = " knee="[k];
     }
+    itoa(line + i, bw_cpus);
+    serial_echo_print(line);
+    serial_echo_print("\n");
+}
 
-    /* Determine the number of SPINSZ chunks for this test */
-    ch = find_chunks(tst);
+/* Report what one CPU got out of test #12 in MB/s of random lines.
+ * Only on the serial console, the free screen rows are where the
+ * errors scroll. */
+static void rord_show(void)
+{
+    char line[48];
+    int i;
+    ulong mbs = rord_kb / rord_ms;
 
-    /* Set the number of iterations. We only do 1/2 of the iterations */
-    /* on the first pass */
-    if (vv->pass == 0) {
-        iter = tseq[tst].iter/FIRST_DIVISER;
-    } else {
-        iter = tseq[tst].iter;
+    for (i = 0; i < 12; i++) {
+        line[i] = "MEMTEST-RAND"[i];
+    }
+    line[i++] = ' ';
+    itoa(line + i, mbs);
+    while (line[i]) {
+        i++;
     }
+    line[i++] = ' ';
+    line[i++] = 'x';
+    itoa(line + i, run_cpus);
+    serial_echo_print(line);
+    serial_echo_print("\n");
+    rord_kb = 0;
+    rord_ms = 0;
+}
 
-    switch(tseq[tst].pat) {
-    case 0: /* Address test, walking ones */
-        ticks = ch;
-        break;
-    case 1: /* Address test, own address */
-    case 2:
-        ticks = ch * 2;
+static void bw_calibrate(int me)
+{
+    ulong tl = 0, th = 0, s, e, us, best;
+    int i, k, n;
+
+    if (me == 0) {
+        bw_len = 0;
+        bw_max = act_cpus;
+        if (smt_mode <= 0 && bw_max > act_cores) {
+            bw_max = act_cores;
+        }
+        if (bw_max > 32) {
+            bw_max = 32;
+        }
+        if (bw_arg > 0) {
+            bw_cpus = bw_arg;
+        }
+        if (bw_arg == 0 && bw_max > 1) {
+            for (i = 0; i < vv->msegs; i++) {
+                s = vv->pmap[i].start;
+                e = vv->pmap[i].end;
+                if (s < 0x100) {
+                    s = 0x100;
+                }
+                if (e > 0x80000) {
+                    e = 0x80000;
+                }
+                if (e > s && e - s > bw_len) {
+                    bw_base = s;
+                    bw_len = e - s;
+                }
+            }
+            bw_len /= bw_max;
+            if (bw_len > BW_MAX_PAGES) {
+                bw_len = BW_MAX_PAGES;
+            }
+            /* Too small to get past the caches */
+            if (bw_len < 256) {
+                bw_len = 0;
+            }
+        }
+    }
+    barrier();
+    if (bw_len == 0) {
+        return;
+    }
+
+    for (k = 0, n = 1; k < BW_PTS; ) {
+        barrier();
+        if (me == 0) {
+            asm __volatile__ ("rdtsc":"=a" (tl),"=d" (th));
+        }
+        if (me < n) {
+            bw_stream((ulong *)((bw_base + me * bw_len) << 12),
+                      bw_len << 10, BW_REPS);
+        }
+        barrier();
+        if (me == 0) {
+            us = bw_us(tl, th);
+            if (us == 0) {
+                us = 1;
+            }
+            bw_n[k] = n;
+            bw_mbs[k] = n * (bw_len << 2) * BW_REPS * 1000 / us *
+                1000 / 1024;
+        }
+        k++;
+        if (n == bw_max) {
+            break;
+        }
+        n = n * 2 < bw_max ? n * 2 : bw_max;
+    }
+    if (me != 0) {
+        return;
+    }
+    bw_pts = k;
+    for (best = 0, k = 0; k < bw_pts; k++) {
+        if (bw_mbs[k] > best) {
+            best = bw_mbs[k];
+        }
+    }
+    for (k = 0; bw_mbs[k] * 10 < best * 9; k++)
+        ;
+    bw_cpus = bw_n[k];
+    bw_show();
+}
+
+/*
+ * Size the chunk a CPU tests between ticks so that one sweep over it
+ * takes about SPIN_MS.  The rate is the single CPU fill rate from the
+ * bandwidth sweep, or the memspeed() copy rate without one.  Ticks
+ * check the keyboard and hold every CPU in a barrier, so this keeps the
+ * cost of a tick the same in time instead of in bytes.  The chunks stay
+ * fixed for the run since all CPUs must agree on the number of ticks.
+ */
+#define SPIN_MS		100
+#define SPIN_MIN_DW	0x100000		/* 4 MB */
+#define SPIN_MAX_DW	0x10000000		/* 1 GB */
+
+static void spin_tune(void)
+{
+    extern ulong spd[];
+    ulong dw, mbs = bw_pts ? bw_mbs[0] : spd[0];
+
+    if (mbs == 0 || (long)mbs < 0) {
+        return;
+    }
+    /* MB/s is about KB/ms, 256 dwords */
+    if (mbs > SPIN_MAX_DW / 256 / SPIN_MS) {
+        dw = SPIN_MAX_DW;
+    } else {
+        dw = mbs * 256 * SPIN_MS;
+    }
+    for (spin_dw = SPIN_MIN_DW; spin_dw < dw && spin_dw < SPIN_MAX_DW; ) {
+        spin_dw <<= 1;
+    }
+}
+
+/* Compute the total number of ticks per pass */
+void find_ticks_for_pass(void)
+{
+    int i;
+
+    if (budget_ms) {
+        budget_plan(0);
+    }
+
+    vv->pptr = 0;
+    vv->pass_ticks = 0;
+    vv->total_ticks = 0;
+    cprint(1, COL_MID+8, "                                         ");
+    i = 0;
+    while (tseq[i].cpu_sel != 0) {
+        /* Skip tests 2 and 4 if we are using 1 cpu */
+        if (act_cpus == 1 && (i == 2 || i == 4)) { 
+            i++;
+            continue;
+        }
+        vv->pass_ticks += find_ticks_for_test(i);
+        i++;
+    }
+}
+
+static int find_ticks_for_test(int tst)
+{
+    if (!test_enabled(tst)) {
+        return(0);
+    }
+
+    /* Determine the number of spin_dw chunks for this test */
+    return ticks_for_iter(tst, test_iter(tst), find_chunks(tst));
+}
+
+/* Number of ticks test 'tst' takes with 'iter' iterations over 'ch'
+ * spin_dw chunks */
+static int ticks_for_iter(int tst, int iter, int ch)
+{
+    int ticks=0;
+
+    switch(tseq[tst].pat) {
+    case 0: /* Address test, walking ones */
+        ticks = ch;
+        break;
+    case 1: /* Address test, own address */
+    case 2:
+        ticks = ch * 2;
         break;
     case 3: /* Moving inversions, all ones and zeros */
     case 4: {
         const int each_movinv1 = ch * (1 + 2 * iter);  // each movinv1()
         ticks = 2 * each_movinv1;                      // which we call twice
+        if (triage && tseq[tst].pat == 3) {
+            ticks = 2 * ch;             // fill_verify() fills and checks once
+        }
         break;
     }
     case 5: { /* Moving inversions, 8 bit walking ones and zeros */
@@ -1178,8 +2016,16 @@ static int find_ticks_for_test(int tst)
         // We also sleep for '2*iter' seconds and tick once per second
         const int sleep_ticks = iter * 2;
         ticks = loop_ticks + sleep_ticks;
+        // With bitfade=overlap one check and one fill of half of
+        // memory, and at most one sleep
+        if (fade_overlap) {
+            ticks = 2 * ch + iter;
+        }
         break;
     }
+    case 12: /* Random order line access, three sweeps */
+        ticks = 3 * ch * iter;
+        break;
     case 90: { /* Modulo 20 check, all ones and zeros (unused) */
         const int each_modtst = ch * (2 + iter);
         ticks = each_modtst * 2 * MOD_SZ;
@@ -1194,12 +2040,828 @@ static int find_ticks_for_test(int tst)
         ASSERT(0);
         break;
     }
-    if (cpu_mode == CPM_SEQ || tseq[tst].cpu_sel == -1) {
+    if (cpu_mode == CPM_SEQ || (tseq[tst].cpu_sel == -1 && !per_share)) {
         ticks *= act_cpus;
     }
     return ticks;
 }
 
+/*
+ * Pass planner for the budget= boot option.
+ *
+ * The time of each test is estimated from the cost of one tick, first
+ * modelled from the memory speed measured at startup and then taken
+ * from the time the test actually needed the last time it ran. To fit
+ * a pass into the budget the planner first drops the tests with the
+ * least coverage per minute, then scales the iterations of the others
+ * down by a common factor. The rest of the pass is re-planned after
+ * every test, so a bad estimate is corrected by the following tests.
+ */
+
+/* Cost of one tick of each pattern, in quarters of the time needed
+ * to copy the chunk */
+static const char plan_cost[] = {
+    1,	/* 0: walking ones, sparse accesses */
+    2,	/* 1, 2: own address, one write or read sweep per tick */
+    2,
+    4,	/* 3 - 6: moving inversions */
+    4,
+    4,
+    4,
+    4,	/* 7: block move */
+    5,	/* 8: moving inversions, 32 bit shifting pattern */
+    8,	/* 9: random number sequence */
+    3,	/* 10: modulo 20 */
+    2,	/* 11: bit fade, one fill or check sweep per tick */
+    16,	/* 12: random order lines, a DRAM access per line */
+};
+
+/* Patterns in the order they are kept when the budget is short, from
+ * the most to the least coverage per minute */
+static const char plan_keep[] = { 0, 3, 5, 1, 7, 9, 6, 10, 2, 8, 12, 11 };
+
+/* Time in ms from the TSC, only good for differences */
+static ulong plan_now(void)
+{
+    ulong l, h;
+
+    asm __volatile__ ("rdtsc":"=a" (l),"=d" (h));
+    return h * ((unsigned)0xffffffff / vv->clks_msec) + l / vv->clks_msec;
+}
+
+/* Iterations of test 'tst' in the current pass without a plan */
+static int default_iter(int tst)
+{
+    /* We only do 1/3 of the iterations on the first pass */
+    if (vv->pass == 0) {
+        return tseq[tst].iter/FIRST_DIVISER;
+    }
+    return tseq[tst].iter;
+}
+
+/* Iterations of test 'tst' in the current pass */
+static int test_iter(int tst)
+{
+    if (triage) {
+        return 1;
+    }
+    if (budget_ms && plan_iter[tst] >= 0) {
+        return plan_iter[tst];
+    }
+    return default_iter(tst);
+}
+
+/* Is test 'tst' selected and not dropped by the planner? */
+static int test_enabled(int tst)
+{
+    return tseq[tst].sel && (budget_ms == 0 || plan_iter[tst] >= 0);
+}
+
+/*
+ * The test the upper CPUs run next to test 'tst' with the mix boot
+ * option.  It is one of the other parallel tests, a different one with
+ * every test and pass so over time both halves of the memory get all of
+ * them while the two groups load memory in different ways.  The
+ * address tests (0 to 2) walk all of the window whatever the slices,
+ * so they neither mix nor get mixed with.
+ */
+static int mix_sliced(int tst)
+{
+    return tseq[tst].cpu_sel > 1 && tseq[tst].pat > 2;
+}
+
+static int mix_pick(int tst)
+{
+    int i, k, n = 0;
+
+    if (!mix_sliced(tst)) {
+        return -1;
+    }
+    for (i = 0; tseq[i].cpu_sel != 0; i++) {
+        if (mix_sliced(i) && tseq[i].pat != tseq[tst].pat &&
+            test_enabled(i)) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return -1;
+    }
+    k = (tst + vv->pass) % n;
+    for (i = 0; ; i++) {
+        if (mix_sliced(i) && tseq[i].pat != tseq[tst].pat &&
+            test_enabled(i) && k-- == 0) {
+            return i;
+        }
+    }
+}
+
+/* Will test 'tst' be run by the scheduler at all? */
+static int plan_runs(int tst)
+{
+    if (tseq[tst].sel == 0) {
+        return 0;
+    }
+    /* Single CPU tests are skipped when not using all CPUs */
+    if (tseq[tst].cpu_sel == -1 && (num_cpus == 1 || cpu_mode != CPM_ALL)) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Modelled us per tick of test 'tst' over 'ch' chunks */
+static ulong plan_model_us(int tst, int ch)
+{
+    extern ulong spd[];
+    ulong kb, speed = spd[0];
+    int run = 1, pat = tseq[tst].pat;
+
+    if (ch == 0) {
+        return 0;
+    }
+    /* Guess 1 GB/s if memspeed() failed */
+    if (speed == 0 || (long)speed < 0) {
+        speed = 1000;
+    }
+    if (cpu_mode == CPM_ALL && tseq[tst].cpu_sel > 1) {
+        run = act_cpus < tseq[tst].cpu_sel ? act_cpus : tseq[tst].cpu_sel;
+    }
+    /* speed is in MB/s, which is about KB/ms */
+    kb = vv->selected_pages / ch * 4 / run;
+    return (kb * 250 / speed) *
+        (pat < sizeof(plan_cost) ? plan_cost[pat] : 4);
+}
+
+/* Estimated ms for test 'tst' with 'iter' iterations over 'ch' chunks */
+static ulong plan_ms(int tst, int iter, int ch)
+{
+    ulong us, ticks, ms = 0;
+
+    if (tseq[tst].pat == 11) {
+        /* The bit fade sleep ticks take a second each */
+        ticks = ticks_for_iter(tst, 0, ch);
+        ms = 2 * iter * 1000;
+    } else {
+        ticks = ticks_for_iter(tst, iter, ch);
+    }
+    us = plan_us[tst] ? plan_us[tst] : plan_model_us(tst, ch);
+    return ms + ticks * (us / 1000) + ticks * (us % 1000) / 1000;
+}
+
+/* Scale 'iter' by 's'/256, keeping at least one iteration */
+static int plan_scale(int iter, int s)
+{
+    if (iter == 0) {
+        return 0;
+    }
+    iter = iter * s / 256;
+    return iter ? iter : 1;
+}
+
+/* Estimated ms for the tests kept from 'from' on, scaled by 's'/256 */
+static ulong plan_total(int from, const int *ch, int s)
+{
+    ulong ms = 0;
+    int i;
+
+    for (i = from; tseq[i].cpu_sel != 0; i++) {
+        if (plan_iter[i] >= 0) {
+            ms += plan_ms(i, plan_scale(default_iter(i), s), ch[i]);
+        }
+    }
+    return ms;
+}
+
+/* Record the cost per tick of test 'tst', which just completed */
+static void budget_measure(int tst)
+{
+    ulong ms;
+
+    if (plan_test_start == 0 || test_ticks == 0 || tseq[tst].pat == 11) {
+        return;
+    }
+    ms = plan_now() - plan_test_start;
+    plan_us[tst] = ms / test_ticks * 1000 + ms % test_ticks * 1000 / test_ticks;
+    if (plan_us[tst] == 0) {
+        plan_us[tst] = 1;
+    }
+    plan_test_start = 0;
+}
+
+/* Plan the iterations of tests 'from' onwards with the time left in
+ * the pass.  Tests before 'from' keep their plan. */
+static void budget_plan(int from)
+{
+    int ch[NUM_TSEQ];
+    int i, k, n, s, hi;
+    ulong avail, used;
+
+    if (from == 0) {
+        avail = budget_ms;
+    } else {
+        used = plan_now() - plan_pass_start;
+        avail = used < budget_ms ? budget_ms - used : 0;
+    }
+
+    /* Start with the default iterations for every test that runs */
+    n = 0;
+    for (i = 0; tseq[i].cpu_sel != 0; i++) {
+        ch[i] = 0;
+        if (i < from) {
+            continue;
+        }
+        plan_iter[i] = -1;
+        if (plan_runs(i)) {
+            ch[i] = find_chunks(i);
+            plan_iter[i] = default_iter(i);
+            n++;
+        }
+    }
+
+    /* Drop the tests with the least coverage per minute until the
+     * others fit with a single iteration each. A pass always keeps
+     * at least one test. */
+    for (k = sizeof(plan_keep) - 1; k >= 0; k--) {
+        if (plan_total(from, ch, 1) <= avail) {
+            break;
+        }
+        for (i = from; tseq[i].cpu_sel != 0; i++) {
+            if (tseq[i].pat != plan_keep[k] || plan_iter[i] < 0) {
+                continue;
+            }
+            if (from == 0 && n == 1) {
+                break;
+            }
+            plan_iter[i] = -1;
+            n--;
+        }
+    }
+
+    /* Find the largest common scale that fits, never above the
+     * default iterations */
+    s = 1;
+    hi = 256;
+    while (s < hi) {
+        k = (s + hi + 1) / 2;
+        if (plan_total(from, ch, k) <= avail) {
+            s = k;
+        } else {
+            hi = k - 1;
+        }
+    }
+    for (i = from; tseq[i].cpu_sel != 0; i++) {
+        if (plan_iter[i] >= 0) {
+            plan_iter[i] = plan_scale(default_iter(i), s);
+        }
+    }
+}
+
+/* Show the plan for the pass and the share of a full pass it covers */
+static void budget_show(void)
+{
+    ulong ms = 0, tplan = 0, tfull = 0;
+    int i, ch;
+
+    cprint(LINE_SCROLL, 0,
+           "Budget:       min/pass   Plan:       min   Coverage:    %");
+    cprint(LINE_SCROLL+1, 0, "Test:");
+    cprint(LINE_SCROLL+2, 0, "Iter:");
+    cprint(LINE_SCROLL+3, 0, "Full:");
+    for (i = 0; tseq[i].cpu_sel != 0; i++) {
+        dprint(LINE_SCROLL+1, 6+4*i, i, 3, 0);
+        if (!plan_runs(i)) {
+            cprint(LINE_SCROLL+2, 6+4*i, "   ");
+            continue;
+        }
+        ch = find_chunks(i);
+        tfull += ticks_for_iter(i, default_iter(i), ch);
+        dprint(LINE_SCROLL+3, 6+4*i, default_iter(i), 3, 0);
+        if (plan_iter[i] < 0) {
+            cprint(LINE_SCROLL+2, 6+4*i, "  -");
+            continue;
+        }
+        tplan += ticks_for_iter(i, plan_iter[i], ch);
+        ms += plan_ms(i, plan_iter[i], ch);
+        dprint(LINE_SCROLL+2, 6+4*i, plan_iter[i], 3, 0);
+    }
+    dprint(LINE_SCROLL, 8, budget_ms / 60000, 5, 0);
+    dprint(LINE_SCROLL, 31, (ms + 59999) / 60000, 5, 0);
+    dprint(LINE_SCROLL, 53, tfull ? tplan * 100 / tfull : 0, 3, 0);
+}
+
+/*
+ * Checkpoint and resume for the resume boot option.
+ *
+ * When the test or the window changes the master CPU echoes where
+ * the test sequence is in hex as a "MEMTEST-CKPT" line on the serial
+ * console.  Many BIOSes keep their settings in the upper CMOS bank, so
+ * the same 32 bytes only go there, where they survive a power loss,
+ * with "ckpt=<offset>".  After a reboot with "resume" the sequence
+ * continues from the checkpoint in CMOS, or from "resume=<hex>".
+ *
+ * A test is self contained within a window, so restarting one only
+ * repeats that window.  The bit fade test keeps a pattern in memory
+ * across windows and so is always restarted from the beginning.  The
+ * random seeds are taken from the TSC for each test and are not kept.
+ */
+#define CKPT_MAGIC	0x4b43544d		/* "MTCK" */
+
+struct ckpt {
+    ulong	magic;
+    ulong	pass;
+    ulong	ecount;
+    ulong	low_page;			/* error address range */
+    ulong	high_page;
+    ulong	win_next;
+    uint16_t	window;
+    uint8_t	test;
+    uint8_t	bitf_seq;
+    uint8_t	cpu_sel;
+    uint8_t	pad[2];
+    uint8_t	sum;				/* bytes add up to zero */
+};
+
+static uint8_t ckpt_sum(const struct ckpt *ck)
+{
+    const uint8_t *b = (const uint8_t *)ck;
+    uint8_t sum = 0;
+    int i;
+
+    for (i = 0; i < sizeof(*ck); i++) {
+        sum += b[i];
+    }
+    return sum;
+}
+
+/* Upper 128 bytes of CMOS through the second index/data port pair */
+static void ckpt_cmos(struct ckpt *ck, int wr)
+{
+    uint8_t *b = (uint8_t *)ck;
+    int i;
+
+    for (i = 0; i < sizeof(*ck); i++) {
+        outb(ckpt_reg + i, 0x72);
+        if (wr) {
+            outb(b[i], 0x73);
+        } else {
+            b[i] = inb(0x73);
+        }
+    }
+}
+
+static void ckpt_save(void)
+{
+    static const char hex[] = "0123456789abcdef";
+    static struct ckpt last;
+    char line[13 + 2 * sizeof(struct ckpt) + 1];
+    struct ckpt ck;
+    uint8_t *b = (uint8_t *)&ck;
+    int i;
+
+    ck.magic = CKPT_MAGIC;
+    ck.pass = vv->pass;
+    ck.ecount = vv->ecount;
+    ck.low_page = vv->erri.low_addr.page;
+    ck.high_page = vv->erri.high_addr.page;
+    ck.test = test;
+    ck.cpu_sel = cpu_sel;
+    ck.pad[0] = ck.pad[1] = 0;
+    if (tseq[test].pat == 11) {
+        ck.window = 0;
+        ck.win_next = 0;
+        ck.bitf_seq = 0;
+    } else {
+        ck.window = window;
+        ck.win_next = win_next;
+        ck.bitf_seq = bitf_seq;
+    }
+    ck.sum = 0;
+    ck.sum = -ckpt_sum(&ck);
+
+    /* Nothing moved, e.g. the bit fade test between windows */
+    if (mt86_memcmp(&ck, &last, sizeof(ck)) == 0) {
+        return;
+    }
+    last = ck;
+    if (ckpt_reg >= 0) {
+        ckpt_cmos(&ck, 1);
+    }
+
+    for (i = 0; i < 12; i++) {
+        line[i] = "MEMTEST-CKPT"[i];
+    }
+    line[i++] = ' ';
+    for (; i < sizeof(line) - 1; b++) {
+        line[i++] = hex[*b >> 4];
+        line[i++] = hex[*b & 0xf];
+    }
+    line[i] = 0;
+    serial_echo_print(line);
+    serial_echo_print("\n");
+}
+
+/* Count the tests of the resumed pass that are already done, again
+ * after each recount of the ticks for the pass */
+static void ckpt_credit(void)
+{
+    int i, t;
+
+    vv->total_ticks = 0;
+    for (i = 0; i < (sched_yield ? yield_pos : test); i++) {
+        t = sched_yield ? yield_seq[i] : i;
+        /* Skipped with 1 cpu, see find_ticks_for_pass() */
+        if (act_cpus == 1 && (t == 2 || t == 4)) {
+            continue;
+        }
+        vv->total_ticks += find_ticks_for_test(t);
+    }
+}
+
+/* Load the checkpoint and continue from it, returns 1 if it did */
+static int ckpt_resume(void)
+{
+    struct ckpt ck;
+    uint8_t *b = (uint8_t *)&ck;
+    char *cp;
+    int i, n;
+
+    /* The checkpoint has to fit in the 128 byte bank */
+    if (ckpt_reg < 0 || ckpt_reg > 128 - sizeof(ck)) {
+        ckpt_reg = -1;
+    }
+    if (ckpt_arg) {
+        for (i = 0, cp = ckpt_arg; i < 2 * sizeof(ck); i++, cp++) {
+            if (!isxdigit(*cp)) {
+                return 0;
+            }
+            n = mt86_isdigit(*cp) ? *cp-'0' : toupper(*cp)-'A'+10;
+            b[i / 2] = (i & 1) ? b[i / 2] | n : n << 4;
+        }
+    } else if (ckpt_reg >= 0) {
+        ckpt_cmos(&ck, 0);
+    } else {
+        return 0;
+    }
+    if (ck.magic != CKPT_MAGIC || ckpt_sum(&ck) != 0 ||
+        ck.test >= NUM_TSEQ - 1 || ck.window > MAX_MEM_PAGES/WIN_SZ_PAGES+2) {
+        return 0;
+    }
+
+    vv->pass = ck.pass;
+    vv->ecount = ck.ecount;
+    if (ck.ecount) {
+        vv->erri.low_addr.page = ck.low_page;
+        vv->erri.high_addr.page = ck.high_page;
+    }
+    test = ck.test;
+    window = ck.window;
+    win_next = ck.win_next;
+    bitf_seq = ck.bitf_seq;
+    cpu_sel = ck.cpu_sel;
+    for (i = 0; sched_yield && i < yield_n; i++) {
+        if (yield_seq[i] == test) {
+            yield_pos = i;
+        }
+    }
+
+    find_ticks_for_pass();
+    ckpt_credit();
+
+    dprint(LINE_INFO, 49, vv->pass, 5, 0);
+    dprint(LINE_INFO, 72, vv->ecount, 6, 0);
+    cprint(LINE_MSG, COL_MSG-8, "Resumed from checkpoint, test");
+    dprint(LINE_MSG, COL_MSG+22, test, 2, 1);
+    return 1;
+}
+
+/*
+ * Hot-spot retest for the hotspot boot option.
+ *
+ * mt86_error() queues the aligned region of hot_pages around each
+ * failing page.  At the end of the current test the master CPU retests
+ * the queued regions by itself with more iterations and patterns than
+ * the main sweep: moving inversions with ones and zeros, a random
+ * pattern and the 32 bit shifting pattern, the random sequence and
+ * modulo 20.  Errors found are reported as usual, after which the main
+ * sweep goes on.  Each region is retested once.
+ */
+void hot_add(ulong page)
+{
+    int i;
+
+    if (hot_pages == 0 || hot_active) {
+        return;
+    }
+    page &= ~(hot_pages - 1);
+    for (i = 0; i < hot_cnt; i++) {
+        if (hot_q[i] == page) {
+            return;
+        }
+    }
+    if (hot_cnt < HOT_MAX) {
+        hot_q[hot_cnt++] = page;
+    }
+}
+
+/* The random patterns of the retest, test_pat() of a test number past
+ * the end of tseq[] so they don't repeat those of the main sweep */
+static ulong hot_pat(void)
+{
+    static int n;
+
+    return test_pat(NUM_TSEQ, n++);
+}
+
+static void hot_run(int me)
+{
+    ulong p1;
+    int i;
+
+    movinv1(HOT_ITER, 0, ~0, me);
+    BAILR;
+    movinv1(HOT_ITER, ~0, 0, me);
+    BAILR;
+    p1 = hot_pat();
+    movinv1(HOT_ITER, p1, ~p1, me);
+    BAILR;
+    for (i=0, p1=1; p1; p1=p1<<1, i++) {
+        movinv32(HOT_ITER, p1, 1, 0x80000000, 0, i, me);
+        BAILR;
+        movinv32(HOT_ITER, ~p1, 0xfffffffe, 0x7fffffff, 1, i, me);
+        BAILR;
+    }
+    for (i = 0; i < HOT_ITER; i++) {
+        movinvr(hot_pat(), me);
+        BAILR;
+    }
+    p1 = hot_pat();
+    for (i = 0; i < MOD_SZ; i++) {
+        modtst(i, HOT_ITER, p1, ~p1, me);
+        BAILR;
+        modtst(i, HOT_ITER, ~p1, p1, me);
+        BAILR;
+    }
+}
+
+/* Region i of the queue lies in the half the bit fade test keeps */
+static int hot_fading(int i)
+{
+    ulong mid = fade_lim[0] + (fade_lim[1] - fade_lim[0]) / 2;
+
+    if (!fade_overlap || !fade_live) {
+        return 0;
+    }
+    if (fade_half == 0) {
+        return hot_q[i] < mid && hot_q[i] + hot_pages > fade_lim[0];
+    }
+    return hot_q[i] < fade_lim[1] && hot_q[i] + hot_pages > mid;
+}
+
+static void hot_retest(int me)
+{
+    struct pmap hwin;
+    int save_nticks = nticks, save_ticks = test_ticks;
+    ulong save_total = vv->total_ticks;
+    ulong save_plim[2] = {vv->plim_lower, vv->plim_upper};
+    int save_run = run_cpus;
+    int i;
+
+    /* Low memory holds our own image unless we run from there */
+    if ((ulong)&_start != LOW_TEST_ADR) {
+        return;
+    }
+
+    /* Regions in the fading half wait until the other half fades */
+    for (i = 0; i < hot_cnt; i++) {
+        if (!hot_tested[i] && !hot_fading(i)) {
+            break;
+        }
+    }
+    if (i == hot_cnt) {
+        return;
+    }
+
+    hot_active = 1;
+    run_cpus = 1;
+    s_barrier_init(1);
+    ret_clear();
+    test_ticks = 0;
+    cprint(LINE_TST, COL_MID+9, "[Hot-spot retest]                      ");
+
+    /* A region may come from either half with bitfade=overlap */
+    if (fade_overlap) {
+        vv->plim_lower = fade_lim[0];
+        vv->plim_upper = fade_lim[1];
+    }
+
+    for (; i < hot_cnt && !bail; i++) {
+        if (hot_tested[i] || hot_fading(i)) {
+            continue;
+        }
+        hwin.start = hot_q[i];
+        hwin.end = hwin.start + hot_pages;
+        if (hwin.start < win0_start) {
+            hwin.start = win0_start;
+        }
+        segs = compute_segments(hwin, me);
+        if (segs && map_page(vv->map[0].pbase_addr) >= 0) {
+            aprint(LINE_RANGE, COL_MID+9, page_of(vv->map[0].start));
+            cprint(LINE_RANGE, COL_MID+14, " - ");
+            aprint(LINE_RANGE, COL_MID+17, page_of(vv->map[segs-1].end));
+            phase_forget(me);
+            hot_run(me);
+            paging_off();
+            if (bail) {
+                break;
+            }
+        }
+        hot_tested[i] = 1;
+        hot_done++;
+    }
+
+    vv->plim_lower = save_plim[0];
+    vv->plim_upper = save_plim[1];
+    cprint(LINE_TST, COL_MID+9, tseq[test].msg);
+    nticks = save_nticks;
+    test_ticks = save_ticks;
+    vv->total_ticks = save_total;
+    run_cpus = save_run;
+    hot_active = 0;
+}
+
+/*
+ * Retention check for the retention boot option.
+ *
+ * Most tests end by leaving one pattern in all of a window and the next
+ * test starts by filling it with another.  For those fills we check the
+ * old pattern on the way, which finds cells that did not hold it for
+ * the time since the window was last written at no extra pass over
+ * memory.  Only the fill first tests (3, 4, 5, 6 and the bit fade fill)
+ * do the check.
+ */
+static void ret_range(ulong *lim)
+{
+    /* bitfade=overlap narrows the test range to a half for each test,
+     * the records stay good for the range that was selected */
+    lim[0] = fade_overlap ? fade_lim[0] : vv->plim_lower;
+    lim[1] = fade_overlap ? fade_lim[1] : vv->plim_upper;
+}
+
+static void ret_clear(void)
+{
+    int i;
+
+    for (i = 0; i < RET_WIN; i++) {
+        ret_valid[i] = 0;
+    }
+    ret_range(ret_plim);
+}
+
+/* The selected test range changed since the records were made */
+static int ret_moved(void)
+{
+    ulong lim[2];
+
+    ret_range(lim);
+    return lim[0] != ret_plim[0] || lim[1] != ret_plim[1];
+}
+
+/* The test covered all of the selected range in this window, a test
+ * on part of it leaves the rest holding something else */
+static int ret_whole(void)
+{
+    ulong lim[2];
+
+    ret_range(lim);
+    return (winx.start >= vv->plim_lower || vv->plim_lower == lim[0]) &&
+        (winx.end <= vv->plim_upper || vv->plim_upper == lim[1]);
+}
+
+/* Pattern the current test leaves in a window, 0 if it is not uniform */
+static int ret_final(ulong *pat)
+{
+    if (tseq[test].pat == 11) {
+        if (fade_overlap) {
+            *pat = fade_pat;
+        } else {
+            *pat = bitf_seq <= 2 ? 0 : 0xffffffff;
+        }
+        return 1;
+    }
+    /* The moving inversion tests know what they left */
+    return phase_fill(mstr_cpu, pat);
+}
+
+/*
+ * Bit fade overlap for the bitfade=overlap boot option.
+ *
+ * Instead of filling all of memory and sleeping, each run of the bit
+ * fade test checks the half of the test range it filled last time,
+ * sleeping only for what is left of the fade time, and fills the other
+ * half.  The other tests of the pass run on the rest of memory while
+ * it fades.  The pattern flips every second pass, so over four passes
+ * each half holds both patterns and gets the other tests twice.
+ */
+static void fade_limit(int half)
+{
+    ulong mid = fade_lim[0] + (fade_lim[1] - fade_lim[0]) / 2;
+
+    vv->plim_lower = half == 1 ? mid : fade_lim[0];
+    vv->plim_upper = half == 0 ? mid : fade_lim[1];
+    fade_set[0] = vv->plim_lower;
+    fade_set[1] = vv->plim_upper;
+
+    /* Keep the size shown and planned with in step */
+    adj_mem();
+}
+
+static void fade_sched(void)
+{
+    ulong mid;
+
+    /* A new test range, at the start or from the configuration menu */
+    if (vv->plim_lower != fade_set[0] || vv->plim_upper != fade_set[1]) {
+        fade_lim[0] = vv->plim_lower;
+        fade_lim[1] = vv->plim_upper;
+        fade_set[0] = vv->plim_lower;
+        fade_set[1] = vv->plim_upper;
+        fade_live = 0;
+
+        /* The relocated image has to stay in the lower half */
+        mid = fade_lim[0] + (fade_lim[1] - fade_lim[0]) / 2;
+        if (mid <= (high_test_adr + (_end - _start)) >> 12) {
+            fade_overlap = 0;
+            return;
+        }
+    }
+
+    if (tseq[test].pat == 11) {
+        fade_limit(fade_half);
+    } else if (fade_live) {
+        fade_limit(!fade_half);
+    } else {
+        fade_limit(-1);
+    }
+}
+
+/*
+ * Yield ordered scheduling for the sched=yield boot option.
+ *
+ * At the start of each pass the selected tests are ordered by the
+ * errors they found per hour of run time so far in this run, plus the
+ * prior rate given with yield=.  Tests with the same rate, and so all
+ * of them before any error, run shortest first, using the last run
+ * time or the planner's estimate.  Every selected test still runs once
+ * per pass, the failures just tend to come up earlier.
+ */
+static ulong yield_rate(int tst)
+{
+    ulong err = tseq[tst].errors;
+
+    if (yield_ms[tst] == 0) {
+        return yield_seed[tst];
+    }
+    /* Keep errors * 3600000 within 32 bits */
+    if (err > 1000) {
+        err = 1000;
+    }
+    return yield_seed[tst] + err * 3600000 / yield_ms[tst];
+}
+
+static void yield_order(void)
+{
+    ulong rate[NUM_TSEQ], ms[NUM_TSEQ];
+    int i, j, t;
+
+    yield_n = 0;
+    yield_pos = 0;
+    for (i = 0; tseq[i].cpu_sel != 0; i++) {
+        if (!tseq[i].sel) {
+            continue;
+        }
+        rate[i] = yield_rate(i);
+        if (yield_runs[i]) {
+            ms[i] = yield_ms[i] / yield_runs[i];
+        } else {
+            ms[i] = plan_ms(i, test_iter(i), find_chunks(i));
+        }
+
+        /* Insert by rate, highest first, then by time */
+        for (j = yield_n; j > 0; j--) {
+            t = yield_seq[j-1];
+            if (rate[t] > rate[i] ||
+                (rate[t] == rate[i] && ms[t] <= ms[i])) {
+                break;
+            }
+            yield_seq[j] = t;
+        }
+        yield_seq[j] = i;
+        yield_n++;
+    }
+    if (yield_n == 0) {
+        yield_seq[yield_n++] = 0;
+    }
+}
+
 static int compute_segments(struct pmap win, int me)
 {
     unsigned long wstart, wend;
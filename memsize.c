@@ -15,7 +15,14 @@ static ulong alt_mem_k = 0;
 static ulong ext_mem_k = 0;
 static struct e820entry e820[E820MAX];
 
+/* Physical ranges from the include= and exclude= options, in pages */
+#define MAX_RANGES 16
+static struct pmap incl[MAX_RANGES], excl[MAX_RANGES];
+static int incl_nr = 0, excl_nr = 0;
+
 static void sort_pmap(void);
+static void coalesce_pmap(void);
+static void merge_ranges(struct pmap *r, int *nr);
 static void memsize_820(void);
 static void memsize_801(void);
 static int sanitize_e820_map(struct e820entry *orig_map, struct e820entry *new_bios, short old_nr);
@@ -61,6 +68,7 @@ void mem_size(void)
 
 	/* Guarantee that pmap entries are in ascending order */
 	sort_pmap();
+	coalesce_pmap();
 	vv->plim_lower = 0;
 	vv->plim_upper = vv->pmap[vv->msegs-1].end;
 
@@ -92,6 +100,131 @@ static void sort_pmap(void)
 		}
 	}
 }
+/*
+ * Merge the sorted pmap entries that touch, like RAM followed by ACPI
+ * reclaim memory, so they become one segment.  Entries with a gap in
+ * between stay apart since the gap is not RAM.
+ */
+static void coalesce_pmap(void)
+{
+	int i, n;
+
+	for (i = 1, n = 0; i < vv->msegs; i++) {
+		if (vv->pmap[i].start <= vv->pmap[n].end) {
+			if (vv->pmap[i].end > vv->pmap[n].end) {
+				vv->pmap[n].end = vv->pmap[i].end;
+			}
+		} else {
+			vv->pmap[++n] = vv->pmap[i];
+		}
+	}
+	if (vv->msegs) {
+		vv->msegs = n + 1;
+	}
+}
+
+/*
+ * Add a range of pages to test only (exclude == 0) or never to test
+ */
+void mem_range_add(int exclude, ulong start, ulong end)
+{
+	struct pmap *r = exclude ? excl : incl;
+	int *nr = exclude ? &excl_nr : &incl_nr;
+
+	if (start >= end || *nr >= MAX_RANGES) {
+		return;
+	}
+	r[*nr].start = start;
+	r[*nr].end = end;
+	(*nr)++;
+}
+
+/* Sort a list of ranges and merge the ones that overlap or touch */
+static void merge_ranges(struct pmap *r, int *nr)
+{
+	struct pmap temp;
+	int i, j, n;
+
+	for (i = 1; i < *nr; i++) {
+		temp = r[i];
+		for (j = i; j > 0 && r[j-1].start > temp.start; j--) {
+			r[j] = r[j-1];
+		}
+		r[j] = temp;
+	}
+	for (i = 1, n = 0; i < *nr; i++) {
+		if (r[i].start <= r[n].end) {
+			if (r[i].end > r[n].end) {
+				r[n].end = r[i].end;
+			}
+		} else {
+			r[++n] = r[i];
+		}
+	}
+	if (*nr) {
+		*nr = n + 1;
+	}
+}
+
+/*
+ * Trim the memory map to the include= ranges, if any, less the
+ * exclude= ranges.  Everything that works from the map, the segments
+ * of each window and the tick estimates, then never sees the excluded
+ * memory.  A list that would leave nothing to test is ignored.
+ */
+void pmap_ranges(void)
+{
+	struct pmap out[MAX_MEM_SEGMENTS];
+	struct pmap all = { 0, 0xffffffff };
+	ulong s, e;
+	int i, j, k, n;
+
+	if (incl_nr == 0 && excl_nr == 0) {
+		return;
+	}
+	merge_ranges(incl, &incl_nr);
+	merge_ranges(excl, &excl_nr);
+
+	n = 0;
+	for (i = 0; i < vv->msegs; i++) {
+		for (j = 0; j < (incl_nr ? incl_nr : 1); j++) {
+			struct pmap *in = incl_nr ? &incl[j] : &all;
+
+			s = vv->pmap[i].start > in->start ?
+				vv->pmap[i].start : in->start;
+			e = vv->pmap[i].end < in->end ?
+				vv->pmap[i].end : in->end;
+
+			/* Cut the excluded ranges out of [s, e) */
+			for (k = 0; k < excl_nr && s < e; k++) {
+				if (excl[k].end <= s || excl[k].start >= e) {
+					continue;
+				}
+				if (excl[k].start > s && n < MAX_MEM_SEGMENTS) {
+					out[n].start = s;
+					out[n++].end = excl[k].start;
+				}
+				s = excl[k].end;
+			}
+			if (s < e && n < MAX_MEM_SEGMENTS) {
+				out[n].start = s;
+				out[n++].end = e;
+			}
+		}
+	}
+	if (n == 0) {
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		vv->pmap[i] = out[i];
+	}
+	vv->msegs = n;
+	vv->plim_lower = 0;
+	vv->plim_upper = vv->pmap[n-1].end;
+	adj_mem();
+}
+
 static void memsize_linuxbios(void)
 {
 	int i, n;
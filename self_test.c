@@ -34,6 +34,12 @@ struct vars variables;
 struct vars* const vv = &variables;
 // Self-test only supports single CPU (ordinal 0) for now:
 volatile int mstr_cpu = 0;
+short triage = 0;
+short stripe_shift = 0;
+extern char ret_arm[];
+extern ulong ret_prev;
+extern int share_cpus, share_turn;
+extern int slice_rot;
 
 void assert_fail(const char* file, int line_no) {
     printf("Failing assert at %s:%d\n", file, line_no);
@@ -79,6 +85,34 @@ void record_chunks(ulong* va, ulong len_dw, const void* vctx) {
     ctx->index++;
 }
 
+// The random pattern of the dword at 'p'
+ulong rnd_expect(const ulong* p, ulong seed) {
+    ulong x = ((ulong)p >> 2) ^ seed;
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+// movinvr() leaves each dword holding a hash of its address and the
+// seed, whatever kernel or CPU split wrote it
+void rnd_verify(ulong seed) {
+    for (ulong* p = vv->map[0].start; p <= vv->map[0].end; p++) {
+        assert(*p == rnd_expect(p, seed));
+    }
+}
+
+// rand_order() visits every line once in each of its three sweeps and
+// leaves the complement of the line pattern xor the address
+void rord_verify(ulong seed) {
+    for (ulong* p = vv->map[0].start; p <= vv->map[0].end; p++) {
+        ulong* line = (ulong*)((ulong)p & ~0x3f);
+        assert(*p == ~(rnd_expect(line, seed) ^ (ulong)p));
+    }
+}
+
 void foreach_tests() {
     foreach_ctx ctx;
     const int me = 0;
@@ -124,6 +158,16 @@ void foreach_tests() {
     assert(ctx.index == 1);
     assert(ctx.chunks[0].va == (ulong*)0x0);
     assert(ctx.chunks[0].len_dw == 0x800000);
+
+    // same with a tuned 4M chunk
+    spin_dw = 0x100000;
+    memset(&ctx, 0, sizeof(ctx));
+    foreach_segment((ulong*)0x0,
+                    (ulong*)0x1fffffc, me, &ctx, record_chunks);
+    assert(ctx.index == 8);
+    assert(ctx.chunks[7].va == (ulong*)0x1c00000);
+    assert(ctx.chunks[7].len_dw == 0x100000);
+    spin_dw = SPINSZ_DWORDS;
 }
 
 int main() {
@@ -131,6 +175,7 @@ int main() {
     vv->debugging = 1;
 
     get_cpuid();
+    kernel_select(KERN_I486);
 
     // add a non-power-of-2 pad to the size, so things don't line
     // up too nicely. Chose 508 because it's not 512.
@@ -179,23 +224,137 @@ int main() {
     // TEST 3, 4, 5, 6
     const ulong pat = 0x112211ee;
     movinv1(iter, pat, ~pat, 0);
+    // Memory now holds the complement, then the fill, of these
+    movinv1(iter, ~pat, pat, 0);
+    movinv1(iter, pat, ~pat, 0);
+
+    // Two CPUs in 4K stripes, one after the other, must cover it all:
+    // the last call finds ~pat everywhere and only checks
+    run_cpus = 2;
+    stripe_shift = 10;
+    movinv1(iter, ~pat, pat, 0);
+    movinv1(iter, ~pat, pat, 1);
+    block_move(iter, 0);
+    block_move(iter, 1);
+    movinv1(iter, ~pat, pat, 0);
+    movinv1(iter, ~pat, pat, 1);
+    run_cpus = 1;
+    stripe_shift = 0;
+    movinv1(iter, ~pat, pat, 0);
+
+    // Two short segments go whole to one CPU each, again checked by
+    // a single CPU that finds the pattern everywhere
+    static ulong small[2][0x1000] __attribute__((aligned(64)));
+    vv->map[1].start = small[0];
+    vv->map[1].end = &small[0][0xfff];
+    vv->map[2].start = small[1];
+    vv->map[2].end = &small[1][0xfff];
+    segs = 3;
+    run_cpus = 2;
+    phase_forget(0);
+    phase_forget(1);
+    movinv1(iter, pat, ~pat, 0);
+    movinv1(iter, pat, ~pat, 1);
+    run_cpus = 1;
+    movinv1(iter, pat, ~pat, 0);
+
+    // Rotated mix= slices still cover everything once
+    run_cpus = 2;
+    slice_rot = 1;
+    phase_forget(0);
+    phase_forget(1);
+    movinv1(iter, ~pat, pat, 0);
+    movinv1(iter, ~pat, pat, 1);
+    run_cpus = 1;
+    slice_rot = 0;
+    movinv1(iter, ~pat, pat, 0);
+
+    // Two percpu=share turns cover all segments once between them
+    share_cpus = 2;
+    share_turn = 0;
+    bit_fade_fill(0x5a5a5a5a, me);
+    share_turn = 1;
+    bit_fade_fill(0x5a5a5a5a, me);
+    share_cpus = 0;
+    bit_fade_chk(0x5a5a5a5a, me);
+    segs = 1;
+
+    // Random patterns come out the same on every CPU and differ by
+    // iteration
+    vv->pass = 3;
+    ulong rp = test_pat(6, 1);
+    assert(test_pat(6, 1) == rp);
+    assert(test_pat(6, 0) != rp);
+    assert(test_pat(10, 1) != rp);
+    vv->pass = 0;
+    movinv1(2, rp, ~rp, me);
 
     // TEST 7
     block_move(iter, me);
 
     // TEST 8
     movinv32(iter, 0x2, 0x1, 0x80000000, 0, 1, me);
+    movinv32(iter, ~0x2, 0xfffffffe, 0x7fffffff, 1, 1, me);
 
     // TEST 9
-    movinvr(me);
+    movinvr(0x2468ace1, me);
+    rnd_verify(0x2468ace1);
+    // Split between two CPUs with a new seed, so memory still holding
+    // the last run's values can't pass for the split's
+    run_cpus = 2;
+    movinvr(0x3579bdf2, 1);
+    movinvr(0x3579bdf2, 0);
+    run_cpus = 1;
+    rnd_verify(0x3579bdf2);
 
     // TEST 10
     modtst(2, 1, 0x5555aaaa, 0xaaaa5555, me);
 
+    // TEST 12, on one CPU and then split between two
+    assert(rand_order(0x0badcafe, me) % 3 == 0);
+    rord_verify(0x0badcafe);
+    run_cpus = 2;
+    rand_order(0x1badcafe, 1);
+    rand_order(0x1badcafe, 0);
+    run_cpus = 1;
+    rord_verify(0x1badcafe);
+
     // TEST 11
     bit_fade_fill(0xdeadbeef, me);
     bit_fade_chk(0xdeadbeef, me);
 
+    // Retention check: the first fill verifies what test 11 left
+    ret_prev = 0xdeadbeef;
+    ret_arm[me] = 1;
+    movinv1(iter, pat, ~pat, me);
+    assert(ret_arm[me] == 0);
+
+    // Triage profile: sparse address test, fill and verify sweep,
+    // page sampled random sequence
+    triage = 1;
+    addr_tst1(me);
+    fill_verify(pat, me);
+    movinvr(0x2468ace1, me);
+    triage = 0;
+
+    // Run the tests built on the dispatched kernels again with
+    // every other kernel variant this CPU supports
+    for (int k = KERN_I486 + 1; k < KERN_COUNT; k++) {
+        if (kernel_select(k) != k) {
+            break;
+        }
+        printf("Kernel variant %s\n", kernel_name());
+        movinv1(iter, pat, ~pat, 0);
+        block_move(iter, me);
+        movinvr(0x13579bdf, me);
+        rnd_verify(0x13579bdf);
+        bit_fade_fill(0xdeadbeef, me);
+        bit_fade_chk(0xdeadbeef, me);
+        ret_prev = 0xdeadbeef;
+        ret_arm[me] = 1;
+        movinv1(iter, pat, ~pat, me);
+    }
+
 
     // Check sentinels, they should not have been overwritten. Do this last.
     for (int j=0; j<kSentinelBytes; j++) {
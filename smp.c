@@ -26,10 +26,16 @@ extern int run_cpus;
 extern int maxcpus;
 extern char cpu_mask[];
 extern struct cpu_ident cpu_id;
+extern int num_to_ord[];
 
 struct barrier_s *barr;
+short park_mwait;		/* park=mwait boot option */
+short smt_mode;			/* smt= boot option, 1 = on, -1 = off */
+int act_cores;			/* selected CPUs that are thread 0 of a core */
+static uint32_t cpu_rank[MAX_CPUS];	/* see smp_topology() */
 
 void smp_find_cpus();
+void smp_set_ordinal(int me, int ord);
 
 void barrier_init(int max)
 {
@@ -43,21 +49,202 @@ void barrier_init(int max)
     barr->st2.slock = 0;
 }
 
+/* Sub-barrier of each CPU number, 1 and 2 for the groups of mix= */
+volatile unsigned char s_grp[MAX_CPUS];
+short s_groups;
+volatile unsigned char s_run[MAX_CPUS];	/* in the sub-barrier this window */
+
+/*
+ * Barrier timeouts, bartimeout= boot option.  Every CPU stamps its
+ * heartbeat when it enters a barrier, including the sub-barrier of
+ * every tick when it runs a test alone, and while it waits in one, so
+ * a CPU whose heartbeat stops for bar_timeout seconds is stuck in a
+ * test.
+ * The first CPU to notice drops it from the barriers and gives the
+ * CPUs above it the next lower ordinal, the test loop picks that up at
+ * the next window.  The BSP is never dropped, it does the relocation.
+ */
+int bar_timeout;			/* seconds, 0 = wait forever */
+volatile unsigned char cpu_gone[MAX_CPUS];
+static volatile ulong cpu_beat[MAX_CPUS*16];	/* one per cache line */
+
+/* TSC in units of 2^20 cycles, good for weeks in 32 bits */
+static inline ulong beat_now(void)
+{
+    ulong l, h;
+
+    asm __volatile__ ("rdtsc":"=a" (l),"=d" (h));
+    return (h << 12) | (l >> 20);
+}
+
+/* Take a CPU that will not arrive out of barrier 'b', releasing the
+ * others if it was the last one they waited for */
+#define BAR_DROP(b) do {			\
+    (b)->maxproc--;				\
+    if (--(b)->count == 0) {			\
+        (b)->st1.slock = 0;			\
+        (b)->st2.slock = 1;			\
+        (b)->count++;				\
+    }						\
+} while (0)
+
+static void bar_evict(int cpu)
+{
+    struct s_barrier_s *s;
+    char line[48];
+    int i, ord;
+
+    spin_lock(&barr->lck);
+    if (cpu_gone[cpu]) {
+        spin_unlock(&barr->lck);
+        return;
+    }
+    cpu_gone[cpu] = 1;
+    BAR_DROP(barr);
+    if (s_run[cpu]) {
+        s = &barr->s[s_grp[cpu]];
+        spin_lock(&s->lck);
+        BAR_DROP(s);
+        spin_unlock(&s->lck);
+    }
+    ord = num_to_ord[cpu];
+    for (i = 0; i < MAX_CPUS; i++) {
+        if (cpu_mask[i] && num_to_ord[i] > ord) {
+            num_to_ord[i]--;
+        }
+    }
+    cpu_mask[cpu] = 0;
+    act_cpus--;
+    spin_unlock(&barr->lck);
+
+    cplace(8, cpu+7, 'X');
+    mt86_memmove(line, "MEMTEST-CPU ", 12);
+    itoa(line + 12, cpu);
+    serial_echo_print(line);
+    serial_echo_print(" stalled, dropped\n");
+}
+
+static void bar_check(ulong now)
+{
+    ulong limit = bar_timeout * (vv->clks_msec / 1049);
+    int i;
+
+    if (limit == 0) {
+        return;
+    }
+    for (i = 1; i < num_cpus; i++) {
+        if (cpu_mask[i] && !cpu_gone[i] && cpu_beat[i*16] &&
+            now - cpu_beat[i*16] > limit) {
+            bar_evict(i);
+        }
+    }
+}
+
+/* Stamp our heartbeat, a CPU that was dropped stays here for good */
+static void bar_beat(int me)
+{
+    if (cpu_gone[me]) {
+        for (;;) {
+            asm __volatile__ ("cli; hlt");
+        }
+    }
+    cpu_beat[me*16] = beat_now() | 1;
+}
+
+/* Wait like spin_wait() but keep the heartbeat going and look for
+ * CPUs whose heartbeat has stopped */
+static void bar_wait(spinlock_t *lck)
+{
+    int me = smp_my_cpu_num();
+    ulong now, last = 0;
+
+    while (*(volatile unsigned int *)&lck->slock == 0) {
+        now = beat_now();
+        if (now != last) {
+            bar_beat(me);
+            bar_check(now);
+            last = now;
+        }
+        if (cpu_id.ext_ecx & CPUID7_ECX_WAITPKG) {
+            tpause_for(vv->clks_msec / 64);
+        } else {
+            asm __volatile__ ("rep ; nop");
+        }
+    }
+}
+
+static void s_init(struct s_barrier_s *s, int max)
+{
+    s->lck.slock = 1;
+    s->maxproc = max;
+    s->count = max;
+    s->st1.slock = 1;
+    s->st2.slock = 0;
+}
+
 void s_barrier_init(int max)
 {
-    barr->s_lck.slock = 1;
-    barr->s_maxproc = max;
-    barr->s_count = max;
-    barr->s_st1.slock = 1;
-    barr->s_st2.slock = 0;
+    s_init(&barr->s[0], max);
+}
+
+/* Sub-barriers for the 'lo' CPUs running the test and the 'hi' CPUs
+ * running the mix= test next to it */
+void s_barrier_split(int lo, int hi)
+{
+    s_init(&barr->s[1], lo);
+    s_init(&barr->s[2], hi);
+}
+
+/*
+ * Wait for the scheduling barrier.  CPUs that are not selected for a
+ * test wait here until it is done, so use the deepest idle state we
+ * trust: MWAIT with the deepest hint from CPUID leaf 5 when asked for
+ * with park=mwait, the write that releases the barrier wakes us up.
+ * Otherwise TPAUSE for short times if the CPU has it, so the active
+ * CPUs get the power and thermal headroom.
+ */
+static void park_wait(spinlock_t *lck)
+{
+    if (bar_timeout) {
+        bar_wait(lck);
+        return;
+    }
+    if (park_mwait && cpu_id.mwait_hint >= 0) {
+        asm volatile(
+            "movl $0,%%ecx\n\t"
+            "movl %%ecx, %%edx\n\t"
+            "1:\n\t"
+            "movl %%edi,%%eax\n\t"
+            "monitor\n\t"
+            "cmpb $0,(%%edi)\n\t"
+            "jne 2f\n\t"
+            "movl %%esi, %%eax\n\t"
+            "mwait\n\t"
+            "jmp 1b\n"
+            "2:"
+            : : "D" (lck), "S" (cpu_id.mwait_hint)
+            : "%eax", "%ecx", "%edx"
+        );
+        return;
+    }
+    if (cpu_id.ext_ecx & CPUID7_ECX_WAITPKG) {
+        while (*(volatile unsigned int *)&lck->slock == 0) {
+            tpause_for(vv->clks_msec / 64);
+        }
+        return;
+    }
+    spin_wait(lck);
 }
 
 void barrier()
 {
-    if (num_cpus == 1 || vv->fail_safe & 3) {
+    if (bar_timeout) {
+        bar_beat(smp_my_cpu_num());
+    }
+    if (num_cpus == 1 || vv->fail_safe & 3 || barr->maxproc == 1) {
         return;
     }
-    spin_wait(&barr->st1);     /* Wait if the barrier is active */
+    park_wait(&barr->st1);     /* Wait if the barrier is active */
     spin_lock(&barr->lck);	   /* Get lock for barr struct */
     if (--barr->count == 0) {  /* Last process? */
         barr->st1.slock = 0;   /* Hold up any processes re-entering */
@@ -66,7 +253,7 @@ void barrier()
         spin_unlock(&barr->lck); 
     } else {
         spin_unlock(&barr->lck); 
-        spin_wait(&barr->st2);	/* wait for peers to arrive */
+        park_wait(&barr->st2);	/* wait for peers to arrive */
         spin_lock(&barr->lck);   
         if (++barr->count == barr->maxproc) { 
             barr->st1.slock = 1; 
@@ -78,25 +265,47 @@ void barrier()
 
 void s_barrier()
 {
+    struct s_barrier_s *s = &barr->s[0];
+
+    /* Beat even when there is nobody to wait for, do_tick() comes
+     * here and a CPU running a test alone has no other barrier */
+    if (bar_timeout) {
+        bar_beat(smp_my_cpu_num());
+    }
     if (run_cpus == 1 || vv->fail_safe & 3) {
         return;
     }
-    spin_wait(&barr->s_st1);     /* Wait if the barrier is active */
-    spin_lock(&barr->s_lck);     /* Get lock for barr struct */
-    if (--barr->s_count == 0) {  /* Last process? */
-        barr->s_st1.slock = 0;   /* Hold up any processes re-entering */
-        barr->s_st2.slock = 1;   /* Release the other processes */
-        barr->s_count++;
-        spin_unlock(&barr->s_lck); 
+    /* With mix= each group of CPUs only waits for its own */
+    if (s_groups) {
+        s = &barr->s[s_grp[smp_my_cpu_num()]];
+    }
+    if (s->maxproc == 1) {
+        return;
+    }
+    if (bar_timeout) {
+        bar_wait(&s->st1);
+    } else {
+        spin_wait(&s->st1);      /* Wait if the barrier is active */
+    }
+    spin_lock(&s->lck);          /* Get lock for barr struct */
+    if (--s->count == 0) {       /* Last process? */
+        s->st1.slock = 0;        /* Hold up any processes re-entering */
+        s->st2.slock = 1;        /* Release the other processes */
+        s->count++;
+        spin_unlock(&s->lck); 
     } else {
-        spin_unlock(&barr->s_lck); 
-        spin_wait(&barr->s_st2);	/* wait for peers to arrive */
-        spin_lock(&barr->s_lck);   
-        if (++barr->s_count == barr->s_maxproc) { 
-            barr->s_st1.slock = 1; 
-            barr->s_st2.slock = 0; 
+        spin_unlock(&s->lck); 
+        if (bar_timeout) {
+            bar_wait(&s->st2);
+        } else {
+            spin_wait(&s->st2);	/* wait for peers to arrive */
+        }
+        spin_lock(&s->lck);   
+        if (++s->count == s->maxproc) { 
+            s->st1.slock = 1; 
+            s->st2.slock = 0; 
         }
-        spin_unlock(&barr->s_lck); 
+        spin_unlock(&s->lck); 
     }
 }
 
@@ -176,37 +385,101 @@ memset (volatile void *dst,
         *((char *) dst + i) = value;
     }
 }
-void initialise_cpus(void)
+/*
+ * Rank the CPUs so that taking them in order spreads the load over the
+ * packages first, then over the cores of each package and only then
+ * over the SMT threads of each core.  The APIC ID fields come from
+ * CPUID leaf 0x1f or 0xb, without them the rank is just the APIC ID.
+ */
+static void smp_topology(void)
 {
+    static const unsigned leaves[] = { 0x1f, 0xb };
+    unsigned eax, ebx, ecx, edx, leaf, n, type, id;
+    unsigned smt_shift = 0, pkg_shift = 0, thread, core;
     int i;
 
+    for (i = 0; i < 2 && pkg_shift == 0; i++) {
+        leaf = leaves[i];
+        if (cpu_id.max_cpuid < leaf) {
+            continue;
+        }
+        for (n = 0; n < 8; n++) {
+            cpuid_count(leaf, n, &eax, &ebx, &ecx, &edx);
+            type = (ecx >> 8) & 0xff;
+            if (type == 0) {
+                break;
+            }
+            if (type == 1) {
+                smt_shift = eax & 0x1f;
+            }
+            pkg_shift = eax & 0x1f;
+        }
+    }
+
+    for (i = 0; i < num_cpus; i++) {
+        id = cpu_num_to_apic_id[i];
+        thread = id & ((1 << smt_shift) - 1);
+        core = (id & ((1 << pkg_shift) - 1)) >> smt_shift;
+        cpu_rank[i] = (thread << 24) | ((core & 0xffff) << 8) |
+            ((id >> pkg_shift) & 0xff);
+    }
+}
+
+/*
+ * Select the CPUs to use and give them their ordinals, the BSP first
+ * and then the others by rank.  maxcpus= keeps the best spread CPUs
+ * instead of the first ones found and smt=off drops the SMT siblings.
+ */
+static void smp_select(void)
+{
+    int i, j, best, ord = 1;
+    char done[MAX_CPUS];
+
+    memset(done, 0, sizeof(done));
+    smp_set_ordinal(0, 0);
+    act_cores = 1;
+    for (j = 1; j < num_cpus; j++) {
+        best = -1;
+        for (i = 1; i < num_cpus; i++) {
+            if (!done[i] && (best < 0 || cpu_rank[i] < cpu_rank[best])) {
+                best = i;
+            }
+        }
+        done[best] = 1;
+        if (!cpu_mask[best]) {
+            continue;
+        }
+        if (ord >= maxcpus || (smt_mode < 0 && cpu_rank[best] >> 24)) {
+            cpu_mask[best] = 0;
+            continue;
+        }
+        if ((cpu_rank[best] >> 24) == 0) {
+            act_cores++;
+        }
+        smp_set_ordinal(best, ord++);
+    }
+    act_cpus = ord;
+}
+
+void initialise_cpus(void)
+{
     act_cpus = 0;
 
     if (maxcpus > 1) {
         smp_find_cpus();
-        /* The total number of CPUs may be limited */
-        if (num_cpus > maxcpus) {
-            num_cpus = maxcpus;
-        }
-        /* Determine how many cpus have been selected */
-        for(i = 0; i < num_cpus; i++) {
-            if (cpu_mask[i]) {
-                act_cpus++;
-            }
-        }
+        smp_topology();
+        smp_select();
     } else {
         act_cpus = found_cpus = num_cpus = 1;
+        act_cores = 1;
     }
 
     /* Initialize the barrier before starting AP's */
     barrier_init(act_cpus);
 
     /* let the BSP initialise the APs. */
-    for(i = 1; i < num_cpus; i++) {
-        /* Only start this CPU if it is selected by the mask */
-        if (cpu_mask[i]) {
-            smp_boot_ap(i);
-        }
+    if (num_cpus > 1) {
+        smp_boot_aps();
     }
 
 }
@@ -262,15 +535,37 @@ void kick_cpu(unsigned cpu_num)
 #define GDTPOINTERADDR 0x9100
 #define GDTADDR 0x9110
 
-void boot_ap(unsigned cpu_num)
+/* Wait for the local APIC to finish sending an IPI */
+static void ipi_wait(void)
 {
-    unsigned num_sipi, apic_id;
+    unsigned timeout = 0;
+    bool send_pending;
+
+    do {
+        delay(10);
+        timeout++;
+        send_pending = (APIC_READ(APICR_ICRLO) & APIC_ICRLO_STATUS_MASK) != 0;
+    } while (send_pending && timeout < 1000);
+
+    if (send_pending) {
+        cprint(LINE_STATUS+3, 0, "SMP: STARTUP IPI was never sent");
+    }
+}
+
+/*
+ * Start all of the selected APs together.  Each step of the INIT, SIPI,
+ * SIPI sequence goes to every AP before the wait that follows it, so
+ * the waits are paid once instead of once per CPU.  The APs then run
+ * the startup code on the shared boot stack one at a time, holding
+ * AP_BOOT_LOCK until smp_ap_booted().
+ */
+static void boot_aps(void)
+{
+    unsigned i, num_sipi, err;
     extern uint8_t gdt; 
     extern uint8_t _ap_trampoline_start;
     extern uint8_t _ap_trampoline_protmode;
     unsigned len = &_ap_trampoline_protmode - &_ap_trampoline_start;
-    apic_id = cpu_num_to_apic_id[cpu_num];
-
 
     memcpy((uint8_t*)BOOTCODESTART, &_ap_trampoline_start, len);
 
@@ -286,35 +581,38 @@ void boot_ap(unsigned cpu_num)
     // temporary GDT.
     memcpy((uint8_t *)GDTADDR, &gdt, 32);
 
+    PUT_MEM32(AP_BOOT_LOCK, 0);
+
     // clear the APIC ESR register
     APIC_WRITE(APICR_ESR, 0);
     APIC_READ(APICR_ESR);
 
-    // asserting the INIT IPI
-    SEND_IPI(apic_id, APIC_TRIGGER_LEVEL, 1, APIC_DELMODE_INIT, 0);
+    // assert and de-assert the INIT IPI on every AP
+    for (i = 1; i < num_cpus; i++) {
+        if (cpu_mask[i]) {
+            SEND_IPI(cpu_num_to_apic_id[i], APIC_TRIGGER_LEVEL, 1,
+                     APIC_DELMODE_INIT, 0);
+            ipi_wait();
+        }
+    }
     delay(100000 / DELAY_FACTOR);
-
-    // de-assert the INIT IPI
-    SEND_IPI(apic_id, APIC_TRIGGER_LEVEL, 0, APIC_DELMODE_INIT, 0);
+    for (i = 1; i < num_cpus; i++) {
+        if (cpu_mask[i]) {
+            SEND_IPI(cpu_num_to_apic_id[i], APIC_TRIGGER_LEVEL, 0,
+                     APIC_DELMODE_INIT, 0);
+            ipi_wait();
+        }
+    }
 
     for (num_sipi = 0; num_sipi < 2; num_sipi++) {
-        unsigned timeout;
-        bool send_pending;
-        unsigned err;
-
         APIC_WRITE(APICR_ESR, 0);
 
-        SEND_IPI(apic_id, 0, 0, APIC_DELMODE_STARTUP, BOOTCODESTART >> 12);
-
-        timeout = 0;
-        do {
-            delay(10);
-            timeout++;
-            send_pending = (APIC_READ(APICR_ICRLO) & APIC_ICRLO_STATUS_MASK) != 0;
-        } while (send_pending && timeout < 1000);
-
-        if (send_pending) {
-            cprint(LINE_STATUS+3, 0, "SMP: STARTUP IPI was never sent");
+        for (i = 1; i < num_cpus; i++) {
+            if (cpu_mask[i] && !AP[i].started) {
+                SEND_IPI(cpu_num_to_apic_id[i], 0, 0,
+                         APIC_DELMODE_STARTUP, BOOTCODESTART >> 12);
+                ipi_wait();
+            }
         }
       
         delay(100000 / DELAY_FACTOR);
@@ -632,23 +930,35 @@ unsigned my_apic_id()
 void smp_ap_booted(unsigned cpu_num) 
 {
     AP[cpu_num].started = TRUE;
+    /* Done with the boot stack, let the next AP in */
+    PUT_MEM32(AP_BOOT_LOCK, 0);
 }
 
-void smp_boot_ap(unsigned cpu_num)
+void smp_boot_aps(void)
 {
-    unsigned timeout;
+    unsigned timeout, i, waiting;
 
-    boot_ap(cpu_num);
+    boot_aps();
+
+    /* Wait for all of the APs at once */
     timeout = 0;
     do {
         delay(1000 / DELAY_FACTOR);
         timeout++;
-    } while (!AP[cpu_num].started && timeout < 100000 / DELAY_FACTOR);
+        waiting = 0;
+        for (i = 1; i < num_cpus; i++) {
+            if (cpu_mask[i] && !AP[i].started) {
+                waiting++;
+            }
+        }
+    } while (waiting && timeout < 100000 / DELAY_FACTOR);
 
-    if (!AP[cpu_num].started) {
-        cprint(LINE_STATUS+3, 0, "SMP: Boot timeout for");
-        dprint(LINE_STATUS+3, COL_MID, cpu_num,2,1);
-        cprint(LINE_STATUS+3, 26, "Turning off SMP");
+    for (i = 1; i < num_cpus; i++) {
+        if (cpu_mask[i] && !AP[i].started) {
+            cprint(LINE_STATUS+3, 0, "SMP: Boot timeout for");
+            dprint(LINE_STATUS+3, COL_MID, i,2,1);
+            cprint(LINE_STATUS+3, 26, "Turning off SMP");
+        }
     }
 }
 
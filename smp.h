@@ -197,13 +197,22 @@ unsigned smp_my_cpu_num();
 void smp_init_bsp(void);
 void smp_init_aps(void);
 
-void smp_boot_ap(unsigned cpu_num);
+void smp_boot_aps(void);
 void smp_ap_booted(unsigned cpu_num);
 
 typedef struct {
         unsigned int slock;
 } spinlock_t;
 
+struct s_barrier_s
+{
+        spinlock_t lck;
+        int maxproc;
+        volatile int count;
+        spinlock_t st1;
+        spinlock_t st2;
+};
+
 struct barrier_s
 {
         spinlock_t mutex;
@@ -212,17 +221,14 @@ struct barrier_s
         volatile int count;
         spinlock_t st1;
         spinlock_t st2;
-        spinlock_t s_lck;
-        int s_maxproc;
-        volatile int s_count;
-        spinlock_t s_st1;
-        spinlock_t s_st2;
+        struct s_barrier_s s[3];	/* selected CPUs, then mix groups */
 };
 
 void barrier();
 void s_barrier();
 void barrier_init(int max);
 void s_barrier_init(int max);
+void s_barrier_split(int lo, int hi);
 
 static inline void
 __GET_CPUID(int ax, uint32_t *regs)
@@ -318,6 +324,19 @@ static inline void spin_wait(spinlock_t *lck)
 	}
 }
 
+/* Wait in C0.2 for about 'cycles' TSC cycles, CPUs with WAITPKG only */
+static inline void tpause_for(unsigned long cycles)
+{
+	asm volatile(
+		"rdtsc\n\t"
+		"addl %0,%%eax\n\t"
+		"adcl $0,%%edx\n\t"
+		"xorl %%ecx,%%ecx\n\t"
+		".byte 0x66,0x0f,0xae,0xf1\n\t"	/* tpause %ecx */
+		: : "r" (cycles) : "%eax", "%ecx", "%edx", "cc", "memory"
+	);
+}
+
 static inline void spin_lock(spinlock_t *lck)
 {
 	if (cpu_id.fid.bits.mon) {
@@ -23,10 +23,10 @@ extern volatile int    test;
 extern volatile int segs, bail;
 extern int test_ticks, nticks;
 extern struct tseq tseq[];
+extern short triage;
+extern short stripe_shift;
 extern void update_err_counts(void);
 extern void print_err_counts(void);
-void rand_seed( unsigned int seed1, unsigned int seed2, int me);
-ulong rand(int me);
 void poll_errors();
 
 // NOTE(jcoiner):
@@ -43,6 +43,18 @@ void poll_errors();
 
 static const void* const nullptr = 0x0;
 
+ulong spin_dw = SPINSZ_DWORDS;
+ulong pat_seed;
+int share_cpus;		/* percpu=share turns of this test, 0 = none */
+int share_turn;		/* this CPU's turn, 0 .. share_cpus-1 */
+int slice_rot;		/* mix= rotation of the slices, see slice_idx() */
+
+/* The slice of each segment CPU 'me' tests.  With mix= the slices of
+ * the two groups of CPUs swap places every other pass. */
+STATIC int slice_idx(int me) {
+    return slice_rot ? (me + slice_rot) % run_cpus : me;
+}
+
 // Writes *start and *end with the VA range to test.
 //
 // me - this threads CPU number
@@ -50,6 +62,7 @@ static const void* const nullptr = 0x0;
 // align - number of bytes to align each block to
 STATIC void calculate_chunk(ulong** start, ulong** end, int me,
                             int j, int makeMultipleOf) {
+    const int idx = slice_idx(me);
     ulong chunk;
 
     // If we are only running 1 CPU then test the whole block
@@ -66,14 +79,14 @@ STATIC void calculate_chunk(ulong** start, ulong** end, int me,
         chunk = (chunk + (makeMultipleOf-1)) &  ~(makeMultipleOf-1);
 
         // Figure out chunk boundaries
-        *start = (ulong*)((ulong)vv->map[j].start+(chunk*me));
+        *start = (ulong*)((ulong)vv->map[j].start+(chunk*idx));
         /* Set end addrs for the highest CPU num to the
          * end of the segment for rounding errors */
         /* Also rounds down to boundary if needed, may miss some ram but
            better than crashing or producing false errors. */
         /* This rounding probably will never happen as the segments should
            be in 4096 bytes pages if I understand correctly. */
-        if (me == mstr_cpu) {
+        if (idx == run_cpus - 1) {
             *end = (ulong*)(vv->map[j].end);
         } else {
             *end = (ulong*)((ulong)(*start) + chunk);
@@ -82,7 +95,7 @@ STATIC void calculate_chunk(ulong** start, ulong** end, int me,
     }
 }
 
-/* Call segment_fn() for each up-to-SPINSZ segment between
+/* Call segment_fn() for each up-to-spin_dw segment between
  * 'start' and 'end'.
  */
 void foreach_segment
@@ -116,8 +129,8 @@ void foreach_segment
         { BAILR }
 
         // ensure no overflow
-        ASSERT((seg_end_dw + SPINSZ_DWORDS) > seg_end_dw);
-        seg_end_dw += SPINSZ_DWORDS;
+        ASSERT((seg_end_dw + spin_dw) > seg_end_dw);
+        seg_end_dw += spin_dw;
 
         if (seg_end_dw >= end_dw) {
             seg_end_dw = end_dw;
@@ -137,6 +150,76 @@ void foreach_segment
     } while (!done);
 }
 
+/* Is segment 'j' too short to split between 'n' CPUs? */
+STATIC int short_segment(int j, ulong n) {
+    return vv->map[j].end - vv->map[j].start < n * SHORT_SEG_DW - 1;
+}
+
+/* Calls segment_fn() for the short segments in vv->map as one work
+ * unit with a single tick.  Firmware holes can leave dozens of them,
+ * each would otherwise cost a tick and a barrier.  Split between 'n'
+ * CPUs each short segment is tested whole by one of them in turn.
+ */
+STATIC void short_foreach_segment
+(const void* ctx, int me, ulong n, segment_fn func) {
+    int j, k;
+
+    for (j=0; j<segs && !short_segment(j, n); j++)
+        ;
+    if (j == segs) {
+        return;
+    }
+    do_tick(me);
+    { BAILR }
+
+    for (k=0; j<segs; j++) {
+        if (!short_segment(j, n)) {
+            continue;
+        }
+        if (n == 1 || k++ % n == slice_idx(me)) {
+            func(vv->map[j].start,
+                 vv->map[j].end - vv->map[j].start + 1, ctx);
+        }
+    }
+}
+
+/* Calls segment_fn() for the work units of this turn of a percpu=share
+ * test.  The short segments are unit 0 and each spin_dw piece of the
+ * others is one more unit, turn 'share_turn' takes every share_cpus'th
+ * unit.  All of the turns together cover the memory once.
+ */
+STATIC void shared_foreach_segment
+(const void* ctx, int me, segment_fn func) {
+    ulong u = 0, s_dw, e_dw, end_dw;
+    int j;
+
+    for (j=0; j<segs && !short_segment(j, 1); j++)
+        ;
+    if (j < segs) {
+        if (share_turn == 0) {
+            short_foreach_segment(ctx, me, 1, func);
+            { BAILR }
+        }
+        u++;
+    }
+    for (j=0; j<segs; j++) {
+        if (short_segment(j, 1)) {
+            continue;
+        }
+        s_dw = ((ulong)vv->map[j].start) >> 2;
+        end_dw = (((ulong)vv->map[j].end) >> 2) + 1;
+        for (; s_dw < end_dw; s_dw = e_dw, u++) {
+            e_dw = end_dw - s_dw > spin_dw ? s_dw + spin_dw : end_dw;
+            if (u % share_cpus != share_turn) {
+                continue;
+            }
+            do_tick(me);
+            { BAILR }
+            func((ulong*)(s_dw << 2), e_dw - s_dw, ctx);
+        }
+    }
+}
+
 /* Calls segment_fn() for each segment in vv->map.
  *
  * Does not slice by CPU number, so it covers the entire memory.
@@ -145,24 +228,93 @@ void foreach_segment
 STATIC void unsliced_foreach_segment
 (const void* ctx, int me, segment_fn func) {
     int j;
+
+    if (share_cpus > 1) {
+        shared_foreach_segment(ctx, me, func);
+        return;
+    }
+    short_foreach_segment(ctx, me, 1, func);
     for (j=0; j<segs; j++) {
+        if (short_segment(j, 1)) {
+            continue;
+        }
         foreach_segment(vv->map[j].start,
                         vv->map[j].end,
                         me, ctx, func);
     }
 }
 
+/* Call segment_fn() for every run_cpus'th stripe of 1 << stripe_shift
+ * dwords between 'start' and 'end', starting with stripe 'me'.
+ *
+ * Stripes are aligned to their size so all CPUs keep hitting every
+ * channel and bank at once.  Ticks come once per run_cpus * spin_dw
+ * dwords, the same count for every CPU and as for a contiguous chunk.
+ */
+STATIC void striped_foreach_segment
+(ulong* start, ulong* end,
+ int me, const void* ctx, segment_fn func) {
+    const ulong n = run_cpus;
+    const ulong start_dw = ((ulong)start) >> 2;
+    const ulong end_dw = (((ulong)end) >> 2) + 1;
+    const ulong first = start_dw >> stripe_shift;
+    const ulong last = (end_dw - 1) >> stripe_shift;
+    const ulong per_tick = n * (spin_dw >> stripe_shift);
+    const ulong idx = slice_idx(me);
+    ulong blk, blk_last, k, s_dw, e_dw;
+
+    for (blk = first; blk <= last; blk += per_tick) {
+        do_tick(me);
+        { BAILR }
+
+        blk_last = blk + per_tick - 1;
+        if (blk_last > last || blk_last < blk) {
+            blk_last = last;
+        }
+        for (k = blk + (idx + n - blk % n) % n; k <= blk_last; k += n) {
+            s_dw = k << stripe_shift;
+            e_dw = s_dw + (1 << stripe_shift);
+            if (s_dw < start_dw) {
+                s_dw = start_dw;
+            }
+            if (e_dw > end_dw) {
+                e_dw = end_dw;
+            }
+            func((ulong*)(s_dw << 2), e_dw - s_dw, ctx);
+        }
+        if (blk_last == last) {
+            break;
+        }
+    }
+}
+
 /* Calls segment_fn() for each segment to be tested by CPU 'me'.
  *
  * In multicore mode, slices the segments by 'me' (the CPU ordinal
- * number) so that each call will cover only 1/Nth of memory.
+ * number) so that each call will cover only 1/Nth of memory.  With
+ * slice=stripe the slices are interleaved stripes instead of blocks.
  */
 STATIC void sliced_foreach_segment
 (const void *ctx, int me, segment_fn func) {
     int j;
     ulong *start, *end;  // VAs
     ulong* prev_end = 0;
+
+    short_foreach_segment(ctx, me, run_cpus, func);
+    if (stripe_shift && run_cpus > 1) {
+        for (j=0; j<segs; j++) {
+            if (short_segment(j, run_cpus)) {
+                continue;
+            }
+            striped_foreach_segment(vv->map[j].start, vv->map[j].end,
+                                    me, ctx, func);
+        }
+        return;
+    }
     for (j=0; j<segs; j++) {
+        if (short_segment(j, run_cpus)) {
+            continue;
+        }
         calculate_chunk(&start, &end, me, j, 64);
 
         // Ensure no overlap among chunks
@@ -177,7 +329,7 @@ STATIC void sliced_foreach_segment
 }
 
 STATIC void addr_tst1_seg(ulong* restrict buf,
-                          ulong len_dw, const void* unused) {
+                          ulong len_dw, const void* vctx) {
     // Within each segment:
     //  - choose a low dword offset 'off'
     //  - write pat to *off
@@ -189,16 +341,18 @@ STATIC void addr_tst1_seg(ulong* restrict buf,
     //    should alias to the original dword. If adding a given offset
     //    doesn't produce a single bit address flip (because it produced
     //    a carry) subtracting the same offset should give a single bit flip.
-    //  - repeat this, moving off ahead in increments of 1MB;
-    //    this covers address bits within physical memory banks, we hope?
+    //  - repeat this, moving off ahead in increments of 'step_dw'
+    //    (1MB normally); this covers address bits within physical
+    //    memory banks, we hope?
 
+    const ulong step_dw = *(const ulong*)vctx;
     ulong pat;
     int k;
 
     for (pat=0x5555aaaa, k=0; k<2; k++) {
         hprint(LINE_PAT, COL_PAT, pat);
 
-        for (ulong off_dw = 0; off_dw < len_dw; off_dw += (1 << 18)) {
+        for (ulong off_dw = 0; off_dw < len_dw; off_dw += step_dw) {
             buf[off_dw] = pat;
             pat = ~pat;
 
@@ -235,7 +389,12 @@ STATIC void addr_tst1_seg(ulong* restrict buf,
  */
 void addr_tst1(int me)
 {
-    unsliced_foreach_segment(nullptr, me, addr_tst1_seg);
+    /* In triage mode only walk from one offset per segment, which
+     * touches O(log N) addresses instead of one walk per megabyte */
+    const ulong step_dw = triage ? spin_dw : (1 << 18);
+
+    phase_forget(me);
+    unsliced_foreach_segment(&step_dw, me, addr_tst1_seg);
 }
 
 STATIC void addr_tst2_init_segment(ulong* p,
@@ -308,309 +467,1543 @@ STATIC void addr_tst2_check_segment(ulong* p,
 void addr_tst2(int me)
 {
     cprint(LINE_PAT, COL_PAT, "address ");
+    phase_forget(me);
+
+    /* Write each address with its own address */
+    unsliced_foreach_segment(nullptr, me, addr_tst2_init_segment);
+    { BAILR }
+
+    /* Each address should have its own address */
+    unsliced_foreach_segment(nullptr, me, addr_tst2_check_segment);
+}
+
+/*
+ * Page sampling for the triage profile.
+ *
+ * Of every 2^TRIAGE_SAMPLE_SHIFT pages only one, picked by hashing the
+ * page group with 'salt', is passed on to the segment function.  The
+ * pick depends on nothing but the address and the salt, so walking the
+ * same memory again visits the same pages in the same order.
+ */
+typedef struct {
+    const void* ctx;
+    segment_fn func;
+    ulong salt;
+} sample_ctx;
+
+STATIC ulong sample_hash(ulong x) {
+    x ^= x >> 16;
+    x *= 0x7feb352d;
+    x ^= x >> 15;
+    x *= 0x846ca68b;
+    x ^= x >> 16;
+    return x;
+}
+
+/* Random pattern 'i' of test 'tst' in this pass.  It depends only on
+ * its arguments and the boot time salt, so every CPU works out the same
+ * pattern by itself and none has to wait for the master to pick one. */
+ulong test_pat(int tst, int i) {
+    ulong h = sample_hash(pat_seed ^ ((ulong)tst << 24) ^ 0x9e3779b9);
+
+    h = sample_hash(h ^ vv->pass);
+    return sample_hash(h + i);
+}
+
+STATIC void sample_seg(ulong* p, ulong len_dw, const void* vctx) {
+    const sample_ctx* ctx = (const sample_ctx*)vctx;
+    const int shift = TRIAGE_SAMPLE_SHIFT;
+    const ulong mask = (1 << shift) - 1;
+
+    // Work in dword indices, as foreach_segment() does, so the
+    // page at the 4GB boundary does not overflow.
+    const ulong p_dw = ((ulong)p) >> 2;
+    const ulong end_dw = p_dw + len_dw;
+    const ulong last_grp = (end_dw - 1) >> (10 + shift);
+
+    for (ulong grp = p_dw >> (10 + shift); grp <= last_grp; grp++) {
+        ulong page = (grp << shift) + (sample_hash(grp ^ ctx->salt) & mask);
+        ulong s_dw = page << 10;
+        ulong e_dw = s_dw + 1024;
+
+        // The chosen page may lie partly or wholly outside the segment
+        if (s_dw < p_dw) {
+            s_dw = p_dw;
+        }
+        if (e_dw > end_dw) {
+            e_dw = end_dw;
+        }
+        if (s_dw < e_dw) {
+            ctx->func((ulong*)(s_dw << 2), e_dw - s_dw, ctx->ctx);
+        }
+    }
+}
+
+/* Like sliced_foreach_segment(), but in triage mode only covers the
+ * pages chosen by sample_seg().
+ */
+STATIC void sampled_foreach_segment
+(const void* ctx, int me, segment_fn func, ulong salt) {
+    sample_ctx sctx;
+
+    if (!triage) {
+        sliced_foreach_segment(ctx, me, func);
+        return;
+    }
+    sctx.ctx = ctx;
+    sctx.func = func;
+    sctx.salt = salt;
+    sliced_foreach_segment(&sctx, me, sample_seg);
+}
+
+/*
+ * Test kernels
+ *
+ * The fill, bottom-up, top-down, check and move kernels below are
+ * compiled for i486, SSE2, AVX2 and AVX-512 and live side by side in
+ * the image.  kernel_select() picks one at startup from the cpu_id
+ * feature bits, the widest one the CPU supports unless the "kernel="
+ * boot option asks for something narrower.
+ *
+ * The i486 kernels work on any dword range and report their own
+ * errors.  The SIMD kernels only handle whole 64 byte lines; the
+ * kernel_*() drivers run the i486 kernels over the unaligned head and
+ * tail of each range, and over any line where a SIMD compare failed so
+ * that the error is reported against the exact dword.
+ */
+
+int kern_sel = KERN_I486;
+
+STATIC void i486_fill(ulong* p, ulong len_dw, ulong pat) {
+    if (len_dw == 0) return;
+
+    asm __volatile__
+        (
+         "rep\n\t"
+         "stosl\n\t"
+         : "+c" (len_dw), "+D" (p)
+         : "a" (pat)
+         : "memory"
+         );
+}
+
+STATIC void i486_bottom_up(ulong* p, ulong len_dw, ulong p1, ulong p2) {
+    ulong* pe = p + (len_dw - 1);
+
+    if (len_dw == 0) return;
+
+    // Original C code replaced with hand tuned assembly code 
+    // seems broken
+    /*for (; p <= pe; p++) {
+      if ((bad=*p) != p1) {
+      mt86_error((ulong*)p, p1, bad);
+      }
+      *p = p2;
+      }*/
+
+    asm __volatile__
+        (
+         "jmp 2f\n\t"
+         ".p2align 4,,7\n\t"
+         "0:\n\t"
+         "addl $4,%%edi\n\t"
+         "2:\n\t"
+         "movl (%%edi),%%ecx\n\t"
+         "cmpl %%eax,%%ecx\n\t"
+         "jne 3f\n\t"
+         "5:\n\t"
+         "movl %%ebx,(%%edi)\n\t"
+         "cmpl %%edx,%%edi\n\t"
+         "jb 0b\n\t"
+         "jmp 4f\n"
+
+         "3:\n\t"
+         "pushl %%edx\n\t"
+         "pushl %%ebx\n\t"
+         "pushl %%ecx\n\t"
+         "pushl %%eax\n\t"
+         "pushl %%edi\n\t"
+         "call mt86_error\n\t"
+         "popl %%edi\n\t"
+         "popl %%eax\n\t"
+         "popl %%ecx\n\t"
+         "popl %%ebx\n\t"
+         "popl %%edx\n\t"
+         "jmp 5b\n"
+
+         "4:\n\t"
+         : "+D" (p)
+         : "a" (p1), "d" (pe), "b" (p2)
+         : "ecx", "memory"
+         );
+}
+
+STATIC void i486_top_down(ulong* start, ulong len_dw, ulong p1, ulong p2) {
+    ulong* p = start + (len_dw - 1);
+    ulong* pe = start;
+
+    if (len_dw == 0) return;
+
+    //Original C code replaced with hand tuned assembly code
+    // seems broken
+    /*do {
+      if ((bad=*p) != p2) {
+      mt86_error((ulong*)p, p2, bad);
+      }
+      *p = p1;
+      } while (--p >= pe);*/
+
+    asm __volatile__
+        (
+         "jmp 9f\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "subl $4, %%edi\n\t"
+         "9:\n\t"
+         "movl (%%edi),%%ecx\n\t"
+         "cmpl %%ebx,%%ecx\n\t"
+         "jne 6f\n\t"
+         "0:\n\t"
+         "movl %%eax,(%%edi)\n\t"
+         "cmpl %%edi, %%edx\n\t"
+         "jne 1b\n\t"
+         "jmp 7f\n\t"
+
+         "6:\n\t"
+         "pushl %%edx\n\t"
+         "pushl %%eax\n\t"
+         "pushl %%ecx\n\t"
+         "pushl %%ebx\n\t"
+         "pushl %%edi\n\t"
+         "call mt86_error\n\t"
+         "popl %%edi\n\t"
+         "popl %%ebx\n\t"
+         "popl %%ecx\n\t"
+         "popl %%eax\n\t"
+         "popl %%edx\n\t"
+         "jmp 0b\n"
+
+         "7:\n\t"
+         : "+D" (p)
+         : "a" (p1), "d" (pe), "b" (p2)
+         : "ecx", "memory"
+         );
+}
+
+STATIC void i486_check(ulong* p, ulong len_dw, ulong pat) {
+    for (ulong i = 0; i < len_dw; i++) {
+        ulong bad;
+        if ((bad=p[i]) != pat) {
+            mt86_error(p+i, pat, bad);
+        }
+    }
+}
+
+STATIC void i486_move(ulong* dest, const ulong* src, ulong len_dw) {
+    if (len_dw == 0) return;
+
+    asm __volatile__
+        (
+         "cld\n\t"
+         "rep\n\t"
+         "movsl\n\t"
+         : "+D" (dest), "+S" (src), "+c" (len_dw)
+         :
+         : "memory"
+         );
+}
+
+/* Random pattern of the dword at 'p': a hash of its address and the
+ * seed, so any dword can be checked in any order and every CPU, slice
+ * and SIMD lane comes up with the same number.  The SIMD kernels
+ * below compute the same hash, see rnd_k[]. */
+STATIC ulong rnd_pat(const ulong* p, ulong seed) {
+    return sample_hash(((ulong)p >> 2) ^ seed);
+}
+
+STATIC void i486_rnd_fill(ulong* p, ulong len_dw, ulong seed) {
+    for (; len_dw; len_dw--, p++) {
+        *p = rnd_pat(p, seed);
+    }
+}
+
+/* Check for the random pattern xor 'x' and write its complement */
+STATIC void i486_rnd_bottom_up(ulong* p, ulong len_dw, ulong seed,
+                               ulong x) {
+    ulong good, bad;
+
+    for (; len_dw; len_dw--, p++) {
+        good = rnd_pat(p, seed) ^ x;
+        if ((bad = *p) != good) {
+            mt86_error(p, good, bad);
+        }
+        *p = ~good;
+    }
+}
+
+STATIC void i486_rnd_top_down(ulong* p, ulong len_dw, ulong seed,
+                              ulong x) {
+    ulong good, bad;
+
+    for (p += len_dw; len_dw; len_dw--) {
+        p--;
+        good = rnd_pat(p, seed) ^ x;
+        if ((bad = *p) != good) {
+            mt86_error(p, good, bad);
+        }
+        *p = ~good;
+    }
+}
+
+/* Lane numbers, the two multipliers of sample_hash() and the step
+ * from one line to the next for the SIMD random kernels, 16 dwords
+ * each so AVX-512 loads them whole and AVX2 uses the first half. */
+static const ulong rnd_k[4][16] __attribute__((aligned(64))) = {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 0x7feb352d, 0x7feb352d, 0x7feb352d, 0x7feb352d,
+      0x7feb352d, 0x7feb352d, 0x7feb352d, 0x7feb352d,
+      0x7feb352d, 0x7feb352d, 0x7feb352d, 0x7feb352d,
+      0x7feb352d, 0x7feb352d, 0x7feb352d, 0x7feb352d },
+    { 0x846ca68b, 0x846ca68b, 0x846ca68b, 0x846ca68b,
+      0x846ca68b, 0x846ca68b, 0x846ca68b, 0x846ca68b,
+      0x846ca68b, 0x846ca68b, 0x846ca68b, 0x846ca68b,
+      0x846ca68b, 0x846ca68b, 0x846ca68b, 0x846ca68b },
+    { 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16, 16 },
+};
+
+/* SSE2: four xmm registers per line.  Fills and moves use
+ * non-temporal stores so they stream past the caches. */
+
+STATIC void sse2_fill(ulong* p, ulong lines, ulong pat) {
+    asm __volatile__
+        (
+         "movd %2,%%xmm0\n\t"
+         "pshufd $0,%%xmm0,%%xmm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "movntdq %%xmm0,(%0)\n\t"
+         "movntdq %%xmm0,16(%0)\n\t"
+         "movntdq %%xmm0,32(%0)\n\t"
+         "movntdq %%xmm0,48(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         : "+r" (p), "+r" (lines)
+         : "rm" (pat)
+         : "memory"
+         );
+}
+
+STATIC ulong sse2_bottom_up(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p;
+    ulong t;
+
+    asm __volatile__
+        (
+         "movd %3,%%xmm0\n\t"
+         "pshufd $0,%%xmm0,%%xmm0\n\t"
+         "movd %4,%%xmm1\n\t"
+         "pshufd $0,%%xmm1,%%xmm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "movdqa (%0),%%xmm2\n\t"
+         "movdqa 16(%0),%%xmm3\n\t"
+         "movdqa 32(%0),%%xmm4\n\t"
+         "movdqa 48(%0),%%xmm5\n\t"
+         "pcmpeqd %%xmm0,%%xmm2\n\t"
+         "pcmpeqd %%xmm0,%%xmm3\n\t"
+         "pcmpeqd %%xmm0,%%xmm4\n\t"
+         "pcmpeqd %%xmm0,%%xmm5\n\t"
+         "pand %%xmm3,%%xmm2\n\t"
+         "pand %%xmm5,%%xmm4\n\t"
+         "pand %%xmm4,%%xmm2\n\t"
+         "pmovmskb %%xmm2,%2\n\t"
+         "cmpl $0xffff,%2\n\t"
+         "jne 2f\n\t"
+         "movdqa %%xmm1,(%0)\n\t"
+         "movdqa %%xmm1,16(%0)\n\t"
+         "movdqa %%xmm1,32(%0)\n\t"
+         "movdqa %%xmm1,48(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (p1), "rm" (p2)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC ulong sse2_top_down(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p + (lines << 4);
+    ulong t;
+
+    asm __volatile__
+        (
+         "movd %3,%%xmm0\n\t"
+         "pshufd $0,%%xmm0,%%xmm0\n\t"
+         "movd %4,%%xmm1\n\t"
+         "pshufd $0,%%xmm1,%%xmm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "movdqa -64(%0),%%xmm2\n\t"
+         "movdqa -48(%0),%%xmm3\n\t"
+         "movdqa -32(%0),%%xmm4\n\t"
+         "movdqa -16(%0),%%xmm5\n\t"
+         "pcmpeqd %%xmm1,%%xmm2\n\t"
+         "pcmpeqd %%xmm1,%%xmm3\n\t"
+         "pcmpeqd %%xmm1,%%xmm4\n\t"
+         "pcmpeqd %%xmm1,%%xmm5\n\t"
+         "pand %%xmm3,%%xmm2\n\t"
+         "pand %%xmm5,%%xmm4\n\t"
+         "pand %%xmm4,%%xmm2\n\t"
+         "pmovmskb %%xmm2,%2\n\t"
+         "cmpl $0xffff,%2\n\t"
+         "jne 2f\n\t"
+         "movdqa %%xmm0,-16(%0)\n\t"
+         "movdqa %%xmm0,-32(%0)\n\t"
+         "movdqa %%xmm0,-48(%0)\n\t"
+         "movdqa %%xmm0,-64(%0)\n\t"
+         "subl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (p1), "rm" (p2)
+         : "memory"
+         );
+    return lines;
+}
+
+STATIC ulong sse2_check(ulong* p, ulong lines, ulong pat) {
+    ulong* q = p;
+    ulong t;
+
+    asm __volatile__
+        (
+         "movd %3,%%xmm0\n\t"
+         "pshufd $0,%%xmm0,%%xmm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "movdqa (%0),%%xmm2\n\t"
+         "movdqa 16(%0),%%xmm3\n\t"
+         "movdqa 32(%0),%%xmm4\n\t"
+         "movdqa 48(%0),%%xmm5\n\t"
+         "pcmpeqd %%xmm0,%%xmm2\n\t"
+         "pcmpeqd %%xmm0,%%xmm3\n\t"
+         "pcmpeqd %%xmm0,%%xmm4\n\t"
+         "pcmpeqd %%xmm0,%%xmm5\n\t"
+         "pand %%xmm3,%%xmm2\n\t"
+         "pand %%xmm5,%%xmm4\n\t"
+         "pand %%xmm4,%%xmm2\n\t"
+         "pmovmskb %%xmm2,%2\n\t"
+         "cmpl $0xffff,%2\n\t"
+         "jne 2f\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (pat)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC void sse2_move(ulong* dest, const ulong* src, ulong lines) {
+    asm __volatile__
+        (
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "movdqu (%1),%%xmm0\n\t"
+         "movdqu 16(%1),%%xmm1\n\t"
+         "movdqu 32(%1),%%xmm2\n\t"
+         "movdqu 48(%1),%%xmm3\n\t"
+         "movntdq %%xmm0,(%0)\n\t"
+         "movntdq %%xmm1,16(%0)\n\t"
+         "movntdq %%xmm2,32(%0)\n\t"
+         "movntdq %%xmm3,48(%0)\n\t"
+         "addl $64,%1\n\t"
+         "addl $64,%0\n\t"
+         "decl %2\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         : "+r" (dest), "+r" (src), "+r" (lines)
+         :
+         : "memory"
+         );
+}
+
+/* AVX2: two ymm registers per line.  vzeroupper on the way out
+ * avoids SSE/AVX transition penalties in later code. */
+
+STATIC void avx2_fill(ulong* p, ulong lines, ulong pat) {
+    asm __volatile__
+        (
+         "vmovd %2,%%xmm0\n\t"
+         "vpbroadcastd %%xmm0,%%ymm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vmovntdq %%ymm0,(%0)\n\t"
+         "vmovntdq %%ymm0,32(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (p), "+r" (lines)
+         : "rm" (pat)
+         : "memory"
+         );
+}
+
+STATIC ulong avx2_bottom_up(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p;
+    ulong t;
+
+    asm __volatile__
+        (
+         "vmovd %3,%%xmm0\n\t"
+         "vpbroadcastd %%xmm0,%%ymm0\n\t"
+         "vmovd %4,%%xmm1\n\t"
+         "vpbroadcastd %%xmm1,%%ymm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpeqd (%0),%%ymm0,%%ymm2\n\t"
+         "vpcmpeqd 32(%0),%%ymm0,%%ymm3\n\t"
+         "vpand %%ymm3,%%ymm2,%%ymm2\n\t"
+         "vpmovmskb %%ymm2,%2\n\t"
+         "cmpl $-1,%2\n\t"
+         "jne 2f\n\t"
+         "vmovdqa %%ymm1,(%0)\n\t"
+         "vmovdqa %%ymm1,32(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (p1), "rm" (p2)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC ulong avx2_top_down(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p + (lines << 4);
+    ulong t;
+
+    asm __volatile__
+        (
+         "vmovd %3,%%xmm0\n\t"
+         "vpbroadcastd %%xmm0,%%ymm0\n\t"
+         "vmovd %4,%%xmm1\n\t"
+         "vpbroadcastd %%xmm1,%%ymm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpeqd -64(%0),%%ymm1,%%ymm2\n\t"
+         "vpcmpeqd -32(%0),%%ymm1,%%ymm3\n\t"
+         "vpand %%ymm3,%%ymm2,%%ymm2\n\t"
+         "vpmovmskb %%ymm2,%2\n\t"
+         "cmpl $-1,%2\n\t"
+         "jne 2f\n\t"
+         "vmovdqa %%ymm0,-32(%0)\n\t"
+         "vmovdqa %%ymm0,-64(%0)\n\t"
+         "subl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (p1), "rm" (p2)
+         : "memory"
+         );
+    return lines;
+}
+
+STATIC ulong avx2_check(ulong* p, ulong lines, ulong pat) {
+    ulong* q = p;
+    ulong t;
+
+    asm __volatile__
+        (
+         "vmovd %3,%%xmm0\n\t"
+         "vpbroadcastd %%xmm0,%%ymm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpeqd (%0),%%ymm0,%%ymm2\n\t"
+         "vpcmpeqd 32(%0),%%ymm0,%%ymm3\n\t"
+         "vpand %%ymm3,%%ymm2,%%ymm2\n\t"
+         "vpmovmskb %%ymm2,%2\n\t"
+         "cmpl $-1,%2\n\t"
+         "jne 2f\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : "rm" (pat)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC void avx2_move(ulong* dest, const ulong* src, ulong lines) {
+    asm __volatile__
+        (
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vmovdqu (%1),%%ymm0\n\t"
+         "vmovdqu 32(%1),%%ymm1\n\t"
+         "vmovntdq %%ymm0,(%0)\n\t"
+         "vmovntdq %%ymm1,32(%0)\n\t"
+         "addl $64,%1\n\t"
+         "addl $64,%0\n\t"
+         "decl %2\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (dest), "+r" (src), "+r" (lines)
+         :
+         : "memory"
+         );
+}
+
+/* Hash the dword numbers in ymm'i' with the seed in ymm6 into
+ * ymm'o', using ymm't' as scratch.  SSE2 has no 32 bit multiply so
+ * there is no SSE2 version, it uses the i486 random kernels. */
+#define AVX2_RND(i, o, t)						\
+    "vpxor %%ymm6,%%ymm" #i ",%%ymm" #o "\n\t"				\
+    "vpsrld $16,%%ymm" #o ",%%ymm" #t "\n\t"				\
+    "vpxor %%ymm" #t ",%%ymm" #o ",%%ymm" #o "\n\t"			\
+    "vpmulld 64(%[k]),%%ymm" #o ",%%ymm" #o "\n\t"			\
+    "vpsrld $15,%%ymm" #o ",%%ymm" #t "\n\t"				\
+    "vpxor %%ymm" #t ",%%ymm" #o ",%%ymm" #o "\n\t"			\
+    "vpmulld 128(%[k]),%%ymm" #o ",%%ymm" #o "\n\t"			\
+    "vpsrld $16,%%ymm" #o ",%%ymm" #t "\n\t"				\
+    "vpxor %%ymm" #t ",%%ymm" #o ",%%ymm" #o "\n\t"
+
+/* Dword numbers of the line at %0 in ymm0 and ymm1, 'adj' moves them
+ * to another line */
+#define AVX2_RND_IDX(adj)						\
+    "vmovd %0,%%xmm0\n\t"						\
+    "vpbroadcastd %%xmm0,%%ymm0\n\t"					\
+    "vpsrld $2,%%ymm0,%%ymm0\n\t"					\
+    adj									\
+    "vpaddd 32(%[k]),%%ymm0,%%ymm1\n\t"				\
+    "vpaddd (%[k]),%%ymm0,%%ymm0\n\t"
+
+STATIC void avx2_rnd_fill(ulong* p, ulong lines, ulong seed) {
+    asm __volatile__
+        (
+         AVX2_RND_IDX("")
+         "vmovd %[seed],%%xmm6\n\t"
+         "vpbroadcastd %%xmm6,%%ymm6\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX2_RND(0, 2, 4)
+         AVX2_RND(1, 3, 5)
+         "vmovntdq %%ymm2,(%0)\n\t"
+         "vmovntdq %%ymm3,32(%0)\n\t"
+         "vpaddd 192(%[k]),%%ymm0,%%ymm0\n\t"
+         "vpaddd 192(%[k]),%%ymm1,%%ymm1\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (p), "+r" (lines)
+         : [k] "r" (rnd_k), [seed] "rm" (seed)
+         : "memory"
+         );
+}
+
+STATIC ulong avx2_rnd_bottom_up(ulong* p, ulong lines, ulong seed,
+                                ulong x) {
+    ulong* q = p;
+    ulong t;
+
+    asm __volatile__
+        (
+         AVX2_RND_IDX("")
+         "vmovd %[seed],%%xmm6\n\t"
+         "vpbroadcastd %%xmm6,%%ymm6\n\t"
+         "vmovd %[x],%%xmm7\n\t"
+         "vpbroadcastd %%xmm7,%%ymm7\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX2_RND(0, 2, 4)
+         AVX2_RND(1, 3, 5)
+         "vpxor %%ymm7,%%ymm2,%%ymm2\n\t"
+         "vpxor %%ymm7,%%ymm3,%%ymm3\n\t"
+         "vpcmpeqd (%0),%%ymm2,%%ymm4\n\t"
+         "vpcmpeqd 32(%0),%%ymm3,%%ymm5\n\t"
+         "vpand %%ymm5,%%ymm4,%%ymm4\n\t"
+         "vpmovmskb %%ymm4,%2\n\t"
+         "cmpl $-1,%2\n\t"
+         "jne 2f\n\t"
+         /* ymm4 is all ones when the line matched */
+         "vpxor %%ymm4,%%ymm2,%%ymm2\n\t"
+         "vpxor %%ymm4,%%ymm3,%%ymm3\n\t"
+         "vmovdqa %%ymm2,(%0)\n\t"
+         "vmovdqa %%ymm3,32(%0)\n\t"
+         "vpaddd 192(%[k]),%%ymm0,%%ymm0\n\t"
+         "vpaddd 192(%[k]),%%ymm1,%%ymm1\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : [k] "r" (rnd_k), [seed] "rm" (seed), [x] "rm" (x)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC ulong avx2_rnd_top_down(ulong* p, ulong lines, ulong seed,
+                               ulong x) {
+    ulong* q = p + (lines << 4);
+    ulong t;
+
+    asm __volatile__
+        (
+         AVX2_RND_IDX("vpsubd 192(%[k]),%%ymm0,%%ymm0\n\t")
+         "vmovd %[seed],%%xmm6\n\t"
+         "vpbroadcastd %%xmm6,%%ymm6\n\t"
+         "vmovd %[x],%%xmm7\n\t"
+         "vpbroadcastd %%xmm7,%%ymm7\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX2_RND(0, 2, 4)
+         AVX2_RND(1, 3, 5)
+         "vpxor %%ymm7,%%ymm2,%%ymm2\n\t"
+         "vpxor %%ymm7,%%ymm3,%%ymm3\n\t"
+         "vpcmpeqd -64(%0),%%ymm2,%%ymm4\n\t"
+         "vpcmpeqd -32(%0),%%ymm3,%%ymm5\n\t"
+         "vpand %%ymm5,%%ymm4,%%ymm4\n\t"
+         "vpmovmskb %%ymm4,%2\n\t"
+         "cmpl $-1,%2\n\t"
+         "jne 2f\n\t"
+         "vpxor %%ymm4,%%ymm2,%%ymm2\n\t"
+         "vpxor %%ymm4,%%ymm3,%%ymm3\n\t"
+         "vmovdqa %%ymm3,-32(%0)\n\t"
+         "vmovdqa %%ymm2,-64(%0)\n\t"
+         "vpsubd 192(%[k]),%%ymm0,%%ymm0\n\t"
+         "vpsubd 192(%[k]),%%ymm1,%%ymm1\n\t"
+         "subl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines), "=&r" (t)
+         : [k] "r" (rnd_k), [seed] "rm" (seed), [x] "rm" (x)
+         : "memory"
+         );
+    return lines;
+}
+
+/* AVX-512: one zmm register per line, compares go to a mask
+ * register so a line is tested with a single kortest. */
+
+STATIC void avx512_fill(ulong* p, ulong lines, ulong pat) {
+    asm __volatile__
+        (
+         "vpbroadcastd %2,%%zmm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vmovntdq %%zmm0,(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (p), "+r" (lines)
+         : "r" (pat)
+         : "memory"
+         );
+}
+
+STATIC ulong avx512_bottom_up(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p;
+
+    asm __volatile__
+        (
+         "vpbroadcastd %2,%%zmm0\n\t"
+         "vpbroadcastd %3,%%zmm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpneqd (%0),%%zmm0,%%k1\n\t"
+         "kortestw %%k1,%%k1\n\t"
+         "jnz 2f\n\t"
+         "vmovdqa32 %%zmm1,(%0)\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines)
+         : "r" (p1), "r" (p2)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC ulong avx512_top_down(ulong* p, ulong lines, ulong p1, ulong p2) {
+    ulong* q = p + (lines << 4);
+
+    asm __volatile__
+        (
+         "vpbroadcastd %2,%%zmm0\n\t"
+         "vpbroadcastd %3,%%zmm1\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpneqd -64(%0),%%zmm1,%%k1\n\t"
+         "kortestw %%k1,%%k1\n\t"
+         "jnz 2f\n\t"
+         "vmovdqa32 %%zmm0,-64(%0)\n\t"
+         "subl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines)
+         : "r" (p1), "r" (p2)
+         : "memory"
+         );
+    return lines;
+}
+
+STATIC ulong avx512_check(ulong* p, ulong lines, ulong pat) {
+    ulong* q = p;
+
+    asm __volatile__
+        (
+         "vpbroadcastd %2,%%zmm0\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vpcmpneqd (%0),%%zmm0,%%k1\n\t"
+         "kortestw %%k1,%%k1\n\t"
+         "jnz 2f\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines)
+         : "r" (pat)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC void avx512_move(ulong* dest, const ulong* src, ulong lines) {
+    asm __volatile__
+        (
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         "vmovdqu32 (%1),%%zmm0\n\t"
+         "vmovntdq %%zmm0,(%0)\n\t"
+         "addl $64,%1\n\t"
+         "addl $64,%0\n\t"
+         "decl %2\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (dest), "+r" (src), "+r" (lines)
+         :
+         : "memory"
+         );
+}
+
+/* Hash the dword numbers in zmm0 with the seed in zmm6 into zmm2,
+ * using zmm4 as scratch */
+#define AVX512_RND							\
+    "vpxord %%zmm6,%%zmm0,%%zmm2\n\t"					\
+    "vpsrld $16,%%zmm2,%%zmm4\n\t"					\
+    "vpxord %%zmm4,%%zmm2,%%zmm2\n\t"					\
+    "vpmulld 64(%[k]),%%zmm2,%%zmm2\n\t"				\
+    "vpsrld $15,%%zmm2,%%zmm4\n\t"					\
+    "vpxord %%zmm4,%%zmm2,%%zmm2\n\t"					\
+    "vpmulld 128(%[k]),%%zmm2,%%zmm2\n\t"				\
+    "vpsrld $16,%%zmm2,%%zmm4\n\t"					\
+    "vpxord %%zmm4,%%zmm2,%%zmm2\n\t"
+
+STATIC void avx512_rnd_fill(ulong* p, ulong lines, ulong seed) {
+    asm __volatile__
+        (
+         "vpbroadcastd %0,%%zmm0\n\t"
+         "vpsrld $2,%%zmm0,%%zmm0\n\t"
+         "vpaddd (%[k]),%%zmm0,%%zmm0\n\t"
+         "vpbroadcastd %[seed],%%zmm6\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX512_RND
+         "vmovntdq %%zmm2,(%0)\n\t"
+         "vpaddd 192(%[k]),%%zmm0,%%zmm0\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "sfence\n\t"
+         "vzeroupper\n\t"
+         : "+r" (p), "+r" (lines)
+         : [k] "r" (rnd_k), [seed] "rm" (seed)
+         : "memory"
+         );
+}
+
+STATIC ulong avx512_rnd_bottom_up(ulong* p, ulong lines, ulong seed,
+                                  ulong x) {
+    ulong* q = p;
+
+    asm __volatile__
+        (
+         "vpbroadcastd %0,%%zmm0\n\t"
+         "vpsrld $2,%%zmm0,%%zmm0\n\t"
+         "vpaddd (%[k]),%%zmm0,%%zmm0\n\t"
+         "vpbroadcastd %[seed],%%zmm6\n\t"
+         "vpbroadcastd %[x],%%zmm7\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX512_RND
+         "vpxord %%zmm7,%%zmm2,%%zmm2\n\t"
+         "vpcmpneqd (%0),%%zmm2,%%k1\n\t"
+         "kortestw %%k1,%%k1\n\t"
+         "jnz 2f\n\t"
+         "vpternlogd $0x55,%%zmm2,%%zmm2,%%zmm2\n\t"
+         "vmovdqa32 %%zmm2,(%0)\n\t"
+         "vpaddd 192(%[k]),%%zmm0,%%zmm0\n\t"
+         "addl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines)
+         : [k] "r" (rnd_k), [seed] "rm" (seed), [x] "rm" (x)
+         : "memory"
+         );
+    return ((ulong)q - (ulong)p) >> 6;
+}
+
+STATIC ulong avx512_rnd_top_down(ulong* p, ulong lines, ulong seed,
+                                 ulong x) {
+    ulong* q = p + (lines << 4);
+
+    asm __volatile__
+        (
+         "vpbroadcastd %0,%%zmm0\n\t"
+         "vpsrld $2,%%zmm0,%%zmm0\n\t"
+         "vpsubd 192(%[k]),%%zmm0,%%zmm0\n\t"
+         "vpaddd (%[k]),%%zmm0,%%zmm0\n\t"
+         "vpbroadcastd %[seed],%%zmm6\n\t"
+         "vpbroadcastd %[x],%%zmm7\n\t"
+         ".p2align 4,,7\n\t"
+         "1:\n\t"
+         AVX512_RND
+         "vpxord %%zmm7,%%zmm2,%%zmm2\n\t"
+         "vpcmpneqd -64(%0),%%zmm2,%%k1\n\t"
+         "kortestw %%k1,%%k1\n\t"
+         "jnz 2f\n\t"
+         "vpternlogd $0x55,%%zmm2,%%zmm2,%%zmm2\n\t"
+         "vmovdqa32 %%zmm2,-64(%0)\n\t"
+         "vpsubd 192(%[k]),%%zmm0,%%zmm0\n\t"
+         "subl $64,%0\n\t"
+         "decl %1\n\t"
+         "jnz 1b\n\t"
+         "2:\n\t"
+         "vzeroupper\n\t"
+         : "+r" (q), "+r" (lines)
+         : [k] "r" (rnd_k), [seed] "rm" (seed), [x] "rm" (x)
+         : "memory"
+         );
+    return lines;
+}
+
+/* Line kernels for one variant.  Each takes a 64 byte aligned address
+ * and a non-zero count of 64 byte lines.  bottom_up and check return
+ * the number of lines done before the first mismatch, top_down returns
+ * the number of lines left, the last of them holding the mismatch. */
+typedef struct {
+    const char* name;
+    void  (*fill)(ulong* p, ulong lines, ulong pat);
+    ulong (*bottom_up)(ulong* p, ulong lines, ulong p1, ulong p2);
+    ulong (*top_down)(ulong* p, ulong lines, ulong p1, ulong p2);
+    ulong (*check)(ulong* p, ulong lines, ulong pat);
+    void  (*move)(ulong* dest, const ulong* src, ulong lines);
+    void  (*rnd_fill)(ulong* p, ulong lines, ulong seed);
+    ulong (*rnd_bottom_up)(ulong* p, ulong lines, ulong seed, ulong x);
+    ulong (*rnd_top_down)(ulong* p, ulong lines, ulong seed, ulong x);
+} kernel_ops;
+
+/* Statically initialized so reloc.c fixes the pointers up after
+ * every relocation.  The i486 variant has no line kernels, the
+ * drivers run the i486 kernels over the whole range instead, and
+ * SSE2 has none for the random pattern. */
+static const kernel_ops kernels[KERN_COUNT] = {
+    { "i486",   0, 0, 0, 0, 0, 0, 0, 0 },
+    { "SSE2",   sse2_fill, sse2_bottom_up, sse2_top_down,
+                sse2_check, sse2_move, 0, 0, 0 },
+    { "AVX2",   avx2_fill, avx2_bottom_up, avx2_top_down,
+                avx2_check, avx2_move,
+                avx2_rnd_fill, avx2_rnd_bottom_up, avx2_rnd_top_down },
+    { "AVX512", avx512_fill, avx512_bottom_up, avx512_top_down,
+                avx512_check, avx512_move,
+                avx512_rnd_fill, avx512_rnd_bottom_up, avx512_rnd_top_down },
+};
+
+/* Find the widest kernel variant this CPU can run. The AVX state must
+ * already have been enabled in XCR0 at startup, we read back what was
+ * actually written there rather than what CPUID offers. */
+STATIC int kernel_best(void) {
+    unsigned int eax, ebx, ecx, edx;
+    ulong xcr0 = 0;
+
+    if (!cpu_id.fid.bits.sse2) {
+        return KERN_I486;
+    }
+    /* Unlike the cached copy in cpu_id, a fresh OSXSAVE bit reflects
+     * the current CR4, which tells us whether xgetbv is usable */
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (ecx & (1 << 27)) {
+        asm __volatile__ ("xgetbv" : "=a" (xcr0) : "c" (0) : "edx");
+    }
+    if (!cpu_id.fid.bits.avx || !cpu_id.efid.bits.avx2 ||
+        (xcr0 & 0x06) != 0x06) {
+        return KERN_SSE2;
+    }
+    if (!cpu_id.efid.bits.avx512f || (xcr0 & 0xe6) != 0xe6) {
+        return KERN_AVX2;
+    }
+    return KERN_AVX512;
+}
+
+/* Select the kernel variant to use.  'want' is one of the KERN_*
+ * values or -1 for the widest supported.  Asking for more than the
+ * CPU can do falls back to the widest supported.  Returns the variant
+ * selected. */
+int kernel_select(int want) {
+    int best = kernel_best();
+
+    if (want < 0 || want > best) {
+        want = best;
+    }
+    kern_sel = want;
+    return kern_sel;
+}
+
+const char* kernel_name(void) {
+    return kernels[kern_sel].name;
+}
+
+/* Split 'len_dw' dwords at 'p' into a head up to the first 64 byte
+ * boundary, a number of whole lines and a tail. */
+STATIC ulong kernel_split(ulong* p, ulong len_dw, ulong* lines, ulong* tail) {
+    ulong head = ((-(ulong)p) & 0x3f) >> 2;
+
+    if (head > len_dw) {
+        head = len_dw;
+    }
+    *lines = (len_dw - head) >> 4;
+    *tail = len_dw - head - (*lines << 4);
+    return head;
+}
+
+STATIC void kernel_fill(ulong* p, ulong len_dw, ulong pat) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail;
+
+    if (k->fill == 0) {
+        i486_fill(p, len_dw, pat);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    i486_fill(p, head, pat);
+    p += head;
+    if (lines) {
+        k->fill(p, lines, pat);
+    }
+    i486_fill(p + (lines << 4), tail, pat);
+}
+
+STATIC void kernel_bottom_up(ulong* p, ulong len_dw, ulong p1, ulong p2) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail, n;
+
+    if (k->bottom_up == 0) {
+        i486_bottom_up(p, len_dw, p1, p2);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    i486_bottom_up(p, head, p1, p2);
+    p += head;
+    while (lines) {
+        n = k->bottom_up(p, lines, p1, p2);
+        p += n << 4;
+        lines -= n;
+        if (lines) {
+            /* Let the i486 kernel find and report the bad dwords */
+            i486_bottom_up(p, 16, p1, p2);
+            p += 16;
+            lines--;
+        }
+    }
+    i486_bottom_up(p, tail, p1, p2);
+}
+
+STATIC void kernel_top_down(ulong* p, ulong len_dw, ulong p1, ulong p2) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail;
+    ulong* lp;
+
+    if (k->top_down == 0) {
+        i486_top_down(p, len_dw, p1, p2);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    lp = p + head;
+    i486_top_down(lp + (lines << 4), tail, p1, p2);
+    while (lines) {
+        lines = k->top_down(lp, lines, p1, p2);
+        if (lines) {
+            lines--;
+            i486_top_down(lp + (lines << 4), 16, p1, p2);
+        }
+    }
+    i486_top_down(p, head, p1, p2);
+}
+
+STATIC void kernel_check(ulong* p, ulong len_dw, ulong pat) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail, n;
+
+    if (k->check == 0) {
+        i486_check(p, len_dw, pat);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    i486_check(p, head, pat);
+    p += head;
+    while (lines) {
+        n = k->check(p, lines, pat);
+        p += n << 4;
+        lines -= n;
+        if (lines) {
+            i486_check(p, 16, pat);
+            p += 16;
+            lines--;
+        }
+    }
+    i486_check(p, tail, pat);
+}
+
+/* Copy 'len_dw' dwords upwards, the ranges must not overlap.
+ * Lines are aligned on the destination, the source may be unaligned. */
+STATIC void kernel_move(ulong* dest, const ulong* src, ulong len_dw) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail;
+
+    if (k->move == 0) {
+        i486_move(dest, src, len_dw);
+        return;
+    }
+    head = kernel_split(dest, len_dw, &lines, &tail);
+    i486_move(dest, src, head);
+    dest += head;
+    src += head;
+    if (lines) {
+        k->move(dest, src, lines);
+    }
+    i486_move(dest + (lines << 4), src + (lines << 4), tail);
+}
+
+STATIC void kernel_rnd_fill(ulong* p, ulong len_dw, ulong seed) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail;
+
+    if (k->rnd_fill == 0) {
+        i486_rnd_fill(p, len_dw, seed);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    i486_rnd_fill(p, head, seed);
+    p += head;
+    if (lines) {
+        k->rnd_fill(p, lines, seed);
+    }
+    i486_rnd_fill(p + (lines << 4), tail, seed);
+}
+
+STATIC void kernel_rnd_bottom_up(ulong* p, ulong len_dw, ulong seed,
+                                 ulong x) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail, n;
+
+    if (k->rnd_bottom_up == 0) {
+        i486_rnd_bottom_up(p, len_dw, seed, x);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    i486_rnd_bottom_up(p, head, seed, x);
+    p += head;
+    while (lines) {
+        n = k->rnd_bottom_up(p, lines, seed, x);
+        p += n << 4;
+        lines -= n;
+        if (lines) {
+            i486_rnd_bottom_up(p, 16, seed, x);
+            p += 16;
+            lines--;
+        }
+    }
+    i486_rnd_bottom_up(p, tail, seed, x);
+}
 
-    /* Write each address with its own address */
-    unsliced_foreach_segment(nullptr, me, addr_tst2_init_segment);
-    { BAILR }
+STATIC void kernel_rnd_top_down(ulong* p, ulong len_dw, ulong seed,
+                                ulong x) {
+    const kernel_ops* k = &kernels[kern_sel];
+    ulong head, lines, tail;
+    ulong* lp;
 
-    /* Each address should have its own address */
-    unsliced_foreach_segment(nullptr, me, addr_tst2_check_segment);
+    if (k->rnd_top_down == 0) {
+        i486_rnd_top_down(p, len_dw, seed, x);
+        return;
+    }
+    head = kernel_split(p, len_dw, &lines, &tail);
+    lp = p + head;
+    i486_rnd_top_down(lp + (lines << 4), tail, seed, x);
+    while (lines) {
+        lines = k->rnd_top_down(lp, lines, seed, x);
+        if (lines) {
+            lines--;
+            i486_rnd_top_down(lp + (lines << 4), 16, seed, x);
+        }
+    }
+    i486_rnd_top_down(p, head, seed, x);
 }
 
 typedef struct {
-    int me;
-    ulong xorVal;    
+    ulong seed;
+    ulong xorVal;
 } movinvr_ctx;
 
-STATIC void movinvr_init(ulong* p,
-                         ulong len_dw, const void* vctx) {
-    ulong* pe = p + (len_dw - 1);
+STATIC void movinvr_init(ulong* p, ulong len_dw, const void* vctx) {
     const movinvr_ctx* ctx = (const movinvr_ctx*)vctx;
-    /* Original C code replaced with hand tuned assembly code */
-    /*
-      for (; p <= pe; p++) {
-      *p = rand(me);
-      }
-    */
 
-    asm __volatile__
-        (
-         "jmp L200\n\t"
-         ".p2align 4,,7\n\t"
-         "L201:\n\t"
-         "addl $4,%%edi\n\t"
-         "L200:\n\t"
-         "pushl %%ecx\n\t"
-         "call rand\n\t"
-         "popl %%ecx\n\t"
-         "movl %%eax,(%%edi)\n\t"
-         "cmpl %%ebx,%%edi\n\t"
-         "jb L201\n\t"
-         : : "D" (p), "b" (pe), "c" (ctx->me)
-         : "eax"
-         );
+    kernel_rnd_fill(p, len_dw, ctx->seed);
 }
 
-STATIC void movinvr_body(ulong* p, ulong len_dw, const void* vctx) {
-    ulong* pe = p + (len_dw - 1);
+STATIC void movinvr_bottom_up(ulong* p, ulong len_dw, const void* vctx) {
     const movinvr_ctx* ctx = (const movinvr_ctx*)vctx;
 
-    /* Original C code replaced with hand tuned assembly code */
-				
-    /*for (; p <= pe; p++) {
-      num = rand(me);
-      if (i) {
-      num = ~num;
-      }
-      if ((bad=*p) != num) {
-      mt86_error((ulong*)p, num, bad);
-      }
-      *p = ~num;
-      }*/
+    kernel_rnd_bottom_up(p, len_dw, ctx->seed, ctx->xorVal);
+}
 
-    asm __volatile__
-        (
-         "pushl %%ebp\n\t"
+STATIC void movinvr_top_down(ulong* p, ulong len_dw, const void* vctx) {
+    const movinvr_ctx* ctx = (const movinvr_ctx*)vctx;
 
-         // Skip first increment
-         "jmp L26\n\t"
-         ".p2align 4,,7\n\t"
+    kernel_rnd_top_down(p, len_dw, ctx->seed, ctx->xorVal);
+}
 
-         // increment 4 bytes (32-bits)
-         "L27:\n\t"
-         "addl $4,%%edi\n\t"
+/*
+ * Test all of memory using a "half moving inversions" algorithm using
+ * random numbers and their complement as the data pattern.  The number
+ * for each dword is a hash of its address and 'seed', see rnd_pat(), so
+ * the check can run in either direction: bottom up checking the numbers
+ * and writing their complement, then top down checking the complement
+ * and writing the numbers back.  How memory is split between CPUs does
+ * not change what any dword gets.
+ */
+void movinvr(ulong seed, int me)
+{
+    movinvr_ctx ctx;
+    ctx.seed = seed;
+    ctx.xorVal = 0;
+    phase_forget(me);
 
-         // Check this byte
-         "L26:\n\t"
-
-         // Get next random number, pass in me(edx), random value returned in num(eax)
-         // num = rand(me);
-         // cdecl call maintains all registers except eax, ecx, and edx
-         // We maintain edx with a push and pop here using it also as an input
-         // we don't need the current eax value and want it to change to the return value
-         // we overwrite ecx shortly after this discarding its current value
-         "pushl %%edx\n\t" // Push function inputs onto stack
-         "call rand\n\t"
-         "popl %%edx\n\t" // Remove function inputs from stack
-
-         // XOR the random number with xorVal(ebx), which is either 0xffffffff or 0 depending on the outer loop
-         // if (i) { num = ~num; }
-         "xorl %%ebx,%%eax\n\t"
-
-         // Move the current value of the current position p(edi) into bad(ecx)
-         // (bad=*p)
-         "movl (%%edi),%%ecx\n\t"
+    /* Display the current seed */
+    if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, seed);
 
-         // Compare bad(ecx) to num(eax)
-         "cmpl %%eax,%%ecx\n\t"
+    sampled_foreach_segment(&ctx, me, movinvr_init, seed);
+    { BAILR }
 
-         // If not equal jump the error case
-         "jne L23\n\t"
+    sampled_foreach_segment(&ctx, me, movinvr_bottom_up, seed);
+    { BAILR }
 
-         // Set a new value or not num(eax) at the current position p(edi)
-         // *p = ~num;
-         "L25:\n\t"
-         "movl $0xffffffff,%%ebp\n\t"
-         "xorl %%ebp,%%eax\n\t"
-         "movl %%eax,(%%edi)\n\t"
+    ctx.xorVal = 0xffffffff;
+    sampled_foreach_segment(&ctx, me, movinvr_top_down, seed);
+}
 
-         // Loop until current position p(edi) equals the end position pe(esi)
-         "cmpl %%esi,%%edi\n\t"
-         "jb L27\n\t"
-         "jmp L24\n"
+/*
+ * Random order line test.
+ *
+ * Visits the 64 byte lines of each chunk in the order of a keyed
+ * permutation of their indexes, so the hardware prefetchers have
+ * nothing to follow and the accesses go to DRAM one line at a time.
+ * The permutation is a couple of multiply and xorshift steps over the
+ * next power of two, each one bijective, repeated until the index lands
+ * inside the chunk.  Each dword holds the random pattern of its line
+ * xor its own address.
+ */
+#define RORD_STREAMS	4	/* lines looked up before any is touched */
 
-         // Error case
-         "L23:\n\t"
-         // Must manually maintain eax, ecx, and edx as part of cdecl call convention
-         "pushl %%edx\n\t"
-         "pushl %%ecx\n\t" // Next three pushes are functions input
-         "pushl %%eax\n\t"
-         "pushl %%edi\n\t"
-         "call mt86_error\n\t"
-         "popl %%edi\n\t" // Remove function inputs from stack and restore register values
-         "popl %%eax\n\t"
-         "popl %%ecx\n\t"
-         "popl %%edx\n\t"
-         "jmp L25\n" 
+typedef struct {
+    ulong seed;
+    ulong key;
+    int pass;		/* 0 fill, 1 check and invert, 2 check inverse */
+    ulong* lines;	/* lines visited */
+} rord_ctx;
+
+STATIC ulong rord_step(ulong x, ulong key, int sh, ulong mask) {
+    x = (x * 0x2c1b3c6d + key) & mask;
+    x ^= x >> sh;
+    x = (x * 0x297a2d39) & mask;
+    x ^= x >> sh;
+    return x;
+}
 
-         "L24:\n\t"
-         "popl %%ebp\n\t"
-         :: "D" (p), "S" (pe), "b" (ctx->xorVal),
-          "d" (ctx->me)
-         : "eax", "ecx"
-         );
+/* Fill or check the dword at 'p' of the line with value 'h' */
+STATIC inline void rord_word(ulong* p, ulong h, const rord_ctx* ctx) {
+    ulong good = h ^ (ulong)p, bad;
+
+    if (ctx->pass == 0) {
+        *p = good;
+        return;
+    }
+    if (ctx->pass == 2) {
+        good = ~good;
+    }
+    if ((bad = *p) != good) {
+        mt86_error(p, good, bad);
+    }
+    if (ctx->pass == 1) {
+        *p = ~good;
+    }
+}
+
+/* Fill or check 'len_dw' dwords at 'p', all in one line */
+STATIC void rord_run(ulong* p, ulong len_dw, const rord_ctx* ctx) {
+    const ulong h = rnd_pat((ulong*)((ulong)p & ~0x3f), ctx->seed);
+
+    for (; len_dw; len_dw--, p++) {
+        rord_word(p, h, ctx);
+    }
+}
+
+/* Fill or check the 's' whole lines at l[], going across them a dword
+ * at a time so the first accesses to all of them are in flight
+ * together */
+STATIC void rord_lines(ulong** l, int s, const rord_ctx* ctx) {
+    ulong h[RORD_STREAMS];
+    int d, k;
+
+    for (k = 0; k < s; k++) {
+        h[k] = rnd_pat(l[k], ctx->seed);
+    }
+    for (d = 0; d < 16; d++) {
+        for (k = 0; k < s; k++) {
+            rord_word(l[k] + d, h[k], ctx);
+        }
+    }
+}
+
+STATIC void rord_seg(ulong* p, ulong len_dw, const void* vctx) {
+    const rord_ctx* ctx = (const rord_ctx*)vctx;
+    ulong head, n, tail, mask, q, i, j, x;
+    ulong *lp, *l[RORD_STREAMS];
+    int s, sh;
+
+    head = kernel_split(p, len_dw, &n, &tail);
+    lp = p + head;
+    rord_run(p, head, ctx);
+    rord_run(lp + (n << 4), tail, ctx);
+    if (n == 0) {
+        return;
+    }
+    for (mask = 1, sh = 0; mask < n; mask <<= 1, sh++)
+        ;
+    mask--;
+    sh = (sh + 1) / 2;
+
+    /* Each stream takes its own quarter of the permutation and the
+     * next lines of all of them are accessed together, so their misses
+     * overlap */
+    q = (n + RORD_STREAMS - 1) / RORD_STREAMS;
+    for (i = 0; i < q; i++) {
+        for (s = 0, j = i; s < RORD_STREAMS && j < n; s++, j += q) {
+            x = j;
+            do {
+                x = rord_step(x, ctx->key, sh, mask);
+            } while (x >= n);
+            l[s] = lp + (x << 4);
+        }
+        rord_lines(l, s, ctx);
+    }
+    *ctx->lines += n;
 }
 
 /*
- * Test all of memory using a "half moving inversions" algorithm using random
- * numbers and their complement as the data pattern. Since we are not able to
- * produce random numbers in reverse order testing is only done in the forward
- * direction.
+ * Fill memory with address dependent values in one random line order,
+ * check them and write the complement in a second and check the
+ * complement in a third.  Returns the number of lines visited, for the
+ * random access rate.
  */
-void movinvr(int me)
+ulong rand_order(ulong seed, int me)
 {
-    int i, seed1, seed2;
+    ulong lines = 0;
+    rord_ctx ctx;
 
-    movinvr_ctx ctx;
-    ctx.me = me;
-    ctx.xorVal = 0;
+    ctx.seed = seed;
+    ctx.lines = &lines;
+    phase_forget(me);
 
-    /* Initialize memory with initial sequence of random numbers.  */
-    if (cpu_id.fid.bits.rdtsc) {
-        asm __volatile__ ("rdtsc":"=a" (seed1),"=d" (seed2));
-    } else {
-        seed1 = 521288629 + vv->pass;
-        seed2 = 362436069 - vv->pass;
+    /* Display the current seed */
+    if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, seed);
+
+    for (ctx.pass = 0; ctx.pass < 3; ctx.pass++) {
+        ctx.key = sample_hash(seed + ctx.pass);
+        sliced_foreach_segment(&ctx, me, rord_seg);
+        if (bail) {
+            break;
+        }
     }
+    return lines;
+}
 
-    /* Display the current seed */
-    if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, seed1);
-    rand_seed(seed1, seed2, me);
+/*
+ * Phase planner for the moving inversion tests.
+ *
+ * Each CPU remembers what the last moving inversion call left in the
+ * slice of the window it tests.  When the next call would start by
+ * writing what is already there the fill is skipped.  When memory
+ * holds the complement of the fill the fill is skipped too and each
+ * iteration runs its top down half first, so every cell still goes
+ * through the same checked transitions.  Anything else that writes
+ * memory, and the scheduler between windows, calls phase_forget().
+ */
+#define PH_NONE		0
+#define PH_FILL		1	/* p1 in every dword */
+#define PH_SHIFT	2	/* movinv32() pattern */
 
-    sliced_foreach_segment(&ctx, me, movinvr_init);
-    { BAILR }
+typedef struct {
+    int kind;
+    ulong p1;
+    ulong lb;
+    int sval;
+    int off;
+} phase_state;
 
-    /* Do moving inversions test. Check for initial pattern and then
-     * write the complement for each memory location.
-     */
-    for (i=0; i<2; i++) {
-        rand_seed(seed1, seed2, me);
+static phase_state phase_known[MAX_CPUS];
 
-        if (i) {
-            ctx.xorVal = 0xffffffff;
-        } else {
-            ctx.xorVal = 0;
-        }
+void phase_forget(int me) {
+    phase_known[me].kind = PH_NONE;
+}
 
-        sliced_foreach_segment(&ctx, me, movinvr_body);
-        { BAILR }
+STATIC void phase_set(int me, int kind, ulong p1, ulong lb, int sval,
+                      int off) {
+    phase_state* ps = &phase_known[me];
+
+    ps->kind = kind;
+    ps->p1 = p1;
+    ps->lb = lb;
+    ps->sval = sval;
+    ps->off = off;
+}
+
+STATIC int phase_holds(int me, int kind, ulong p1, ulong lb, int sval,
+                       int off) {
+    const phase_state* ps = &phase_known[me];
+
+    return ps->kind == kind && ps->p1 == p1 && ps->lb == lb &&
+        ps->sval == sval && ps->off == off;
+}
+
+/* Get the pattern filling the slice of CPU 'me', 0 if not uniform */
+int phase_fill(int me, ulong* pat) {
+    if (phase_known[me].kind != PH_FILL) {
+        return 0;
+    }
+    *pat = phase_known[me].p1;
+    return 1;
+}
+
+/* Stream 'n' fills over 'len_dw' dwords at 'p' for the bandwidth sweep */
+void bw_stream(ulong* p, ulong len_dw, int n) {
+    while (n--) {
+        kernel_fill(p, len_dw, n);
+    }
+}
+
+/* Stands in for a skipped sweep so the ticks and barriers still match */
+STATIC void phase_skip(ulong* p, ulong len_dw, const void* vctx) {
+}
+
+/*
+ * Retention check for the retention boot option.
+ *
+ * When the scheduler knows the uniform pattern the previous test left
+ * in a window it arms ret_arm[] for the CPUs testing it.  The first
+ * fill of the window then checks for that pattern while writing the
+ * new one, except between ret_skip_lo and ret_skip_hi (dword indices)
+ * where our own image was copied since.
+ */
+char ret_arm[MAX_CPUS];
+ulong ret_prev;
+ulong ret_skip_lo, ret_skip_hi;
+ulong ret_age;			/* seconds since ret_prev was written */
+short ret_reported;		/* retention errors reported this window */
+
+STATIC void ret_fill(ulong* p, ulong len_dw, ulong pat, int me) {
+    const ulong p_dw = ((ulong)p) >> 2;
+    const ulong end_dw = p_dw + len_dw;
+    ulong lo = ret_skip_lo, hi = ret_skip_hi;
+
+    if (!ret_arm[me]) {
+        kernel_fill(p, len_dw, pat);
+        return;
     }
+    if (lo < p_dw) {
+        lo = p_dw;
+    }
+    if (hi > end_dw) {
+        hi = end_dw;
+    }
+    if (lo >= hi) {
+        kernel_bottom_up(p, len_dw, ret_prev, pat);
+        return;
+    }
+    kernel_bottom_up(p, lo - p_dw, ret_prev, pat);
+    kernel_fill((ulong*)(lo << 2), hi - lo, pat);
+    kernel_bottom_up((ulong*)(hi << 2), end_dw - hi, ret_prev, pat);
 }
 
 typedef struct {
     ulong p1;
     ulong p2;
+    int me;
 } movinv1_ctx;
 
 STATIC void movinv1_init(ulong* start,
                          ulong len_dw, const void* vctx) {
     const movinv1_ctx* ctx = (const movinv1_ctx*)vctx;
 
-    ulong p1 = ctx->p1;
-    ulong* p = start;
-
-    asm __volatile__
-        (
-         "rep\n\t"
-         "stosl\n\t"
-         : : "c" (len_dw), "D" (p), "a" (p1)
-         );
+    ret_fill(start, len_dw, ctx->p1, ctx->me);
 }
 
 STATIC void movinv1_bottom_up(ulong* start,
                               ulong len_dw, const void* vctx) {
     const movinv1_ctx* ctx = (const movinv1_ctx*)vctx;
-    ulong p1 = ctx->p1;
-    ulong p2 = ctx->p2;
-    ulong* p = start;
-    ulong* pe = p + (len_dw - 1);
-
-    // Original C code replaced with hand tuned assembly code 
-    // seems broken
-    /*for (; p <= pe; p++) {
-      if ((bad=*p) != p1) {
-      mt86_error((ulong*)p, p1, bad);
-      }
-      *p = p2;
-      }*/
-
-    asm __volatile__
-        (
-         "jmp L2\n\t"
-         ".p2align 4,,7\n\t"
-         "L0:\n\t"
-         "addl $4,%%edi\n\t"
-         "L2:\n\t"
-         "movl (%%edi),%%ecx\n\t"
-         "cmpl %%eax,%%ecx\n\t"
-         "jne L3\n\t"
-         "L5:\n\t"
-         "movl %%ebx,(%%edi)\n\t"
-         "cmpl %%edx,%%edi\n\t"
-         "jb L0\n\t"
-         "jmp L4\n"
-
-         "L3:\n\t"
-         "pushl %%edx\n\t"
-         "pushl %%ebx\n\t"
-         "pushl %%ecx\n\t"
-         "pushl %%eax\n\t"
-         "pushl %%edi\n\t"
-         "call mt86_error\n\t"
-         "popl %%edi\n\t"
-         "popl %%eax\n\t"
-         "popl %%ecx\n\t"
-         "popl %%ebx\n\t"
-         "popl %%edx\n\t"
-         "jmp L5\n"
 
-         "L4:\n\t"
-         :: "a" (p1), "D" (p), "d" (pe), "b" (p2)
-         : "ecx"
-         );
+    kernel_bottom_up(start, len_dw, ctx->p1, ctx->p2);
 }
 
 STATIC void movinv1_top_down(ulong* start,
                              ulong len_dw, const void* vctx) {
     const movinv1_ctx* ctx = (const movinv1_ctx*)vctx;
-    ulong p1 = ctx->p1;
-    ulong p2 = ctx->p2;
-    ulong* p = start + (len_dw - 1);
-    ulong* pe = start;
-
-    //Original C code replaced with hand tuned assembly code
-    // seems broken
-    /*do {
-      if ((bad=*p) != p2) {
-      mt86_error((ulong*)p, p2, bad);
-      }
-      *p = p1;
-      } while (--p >= pe);*/
-
-    asm __volatile__
-        (
-         "jmp L9\n\t"
-         ".p2align 4,,7\n\t"
-         "L11:\n\t"
-         "subl $4, %%edi\n\t"
-         "L9:\n\t"
-         "movl (%%edi),%%ecx\n\t"
-         "cmpl %%ebx,%%ecx\n\t"
-         "jne L6\n\t"
-         "L10:\n\t"
-         "movl %%eax,(%%edi)\n\t"
-         "cmpl %%edi, %%edx\n\t"
-         "jne L11\n\t"
-         "jmp L7\n\t"
 
-         "L6:\n\t"
-         "pushl %%edx\n\t"
-         "pushl %%eax\n\t"
-         "pushl %%ecx\n\t"
-         "pushl %%ebx\n\t"
-         "pushl %%edi\n\t"
-         "call mt86_error\n\t"
-         "popl %%edi\n\t"
-         "popl %%ebx\n\t"
-         "popl %%ecx\n\t"
-         "popl %%eax\n\t"
-         "popl %%edx\n\t"
-         "jmp L10\n"
-
-         "L7:\n\t"
-         :: "a" (p1), "D" (p), "d" (pe), "b" (p2)
-         : "ecx"
-         );
+    kernel_top_down(start, len_dw, ctx->p1, ctx->p2);
 }
 
 /*
@@ -619,7 +2012,7 @@ STATIC void movinv1_top_down(ulong* start,
  */
 void movinv1 (int iter, ulong p1, ulong p2, int me)
 {
-    int i;
+    int i, rev;
 
     /* Display the current pattern */
     if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, p1);
@@ -627,13 +2020,25 @@ void movinv1 (int iter, ulong p1, ulong p2, int me)
     movinv1_ctx ctx;
     ctx.p1 = p1;
     ctx.p2 = p2;
-    sliced_foreach_segment(&ctx, me, movinv1_init);
+    ctx.me = me;
+    rev = phase_holds(me, PH_FILL, p2, 0, 0, 0);
+    if (rev || phase_holds(me, PH_FILL, p1, 0, 0, 0)) {
+        sliced_foreach_segment(&ctx, me, phase_skip);
+    } else {
+        sliced_foreach_segment(&ctx, me, movinv1_init);
+    }
+    phase_forget(me);
+    ret_arm[me] = 0;
     { BAILR }
 
     /* Do moving inversions test. Check for initial pattern and then
      * write the complement for each memory location. Test from bottom
      * up and then from the top down.  */
     for (i=0; i<iter; i++) {
+        if (rev) {
+            sliced_foreach_segment(&ctx, me, movinv1_top_down);
+            { BAILR }
+        }
         sliced_foreach_segment(&ctx, me, movinv1_bottom_up);
         { BAILR }
 
@@ -649,9 +2054,41 @@ void movinv1 (int iter, ulong p1, ulong p2, int me)
         // and that there's little to be gained from reversing the direction of
         // the outer loops. So I'm leaving a 'direction' bit off of the
         // foreach_segment() routines for now.
-        sliced_foreach_segment(&ctx, me, movinv1_top_down);
-        { BAILR }
+        if (!rev) {
+            sliced_foreach_segment(&ctx, me, movinv1_top_down);
+            { BAILR }
+        }
     }
+    phase_set(me, PH_FILL, rev ? p2 : p1, 0, 0, 0);
+}
+
+STATIC void fill_verify_check(ulong* start,
+                              ulong len_dw, const void* vctx) {
+    const movinv1_ctx* ctx = (const movinv1_ctx*)vctx;
+
+    kernel_check(start, len_dw, ctx->p1);
+}
+
+/*
+ * Fill memory with the pattern in p1 and read it back once, for the
+ * triage profile.  This is the first half of movinv1(), using the
+ * streaming stores of the fill kernel, and verifies the result.
+ */
+void fill_verify(ulong p1, int me)
+{
+    if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, p1);
+
+    movinv1_ctx ctx;
+    ctx.p1 = p1;
+    ctx.p2 = ~p1;
+    ctx.me = me;
+    phase_forget(me);
+    sliced_foreach_segment(&ctx, me, movinv1_init);
+    ret_arm[me] = 0;
+    { BAILR }
+
+    sliced_foreach_segment(&ctx, me, fill_verify_check);
+    phase_set(me, PH_FILL, p1, 0, 0, 0);
 }
 
 typedef struct {
@@ -934,18 +2371,37 @@ void movinv32(int iter, ulong p1, ulong lb, ulong hb, int sval, int off,int me)
     /* Display the current pattern */
     if (mstr_cpu == me) hprint(LINE_PAT, COL_PAT, p1);
 
-    sliced_foreach_segment(&ctx, me, movinv32_init);
+    /* The complement of the pattern is the one with every parameter
+     * inverted, which is what the two callsites alternate between */
+    int rev = phase_holds(me, PH_SHIFT, ~p1, ~lb, !sval, off);
+    if (rev || phase_holds(me, PH_SHIFT, p1, lb, sval, off)) {
+        sliced_foreach_segment(&ctx, me, phase_skip);
+    } else {
+        sliced_foreach_segment(&ctx, me, movinv32_init);
+    }
+    phase_forget(me);
     { BAILR }
 
     /* Do moving inversions test. Check for initial pattern and then
      * write the complement for each memory location. Test from bottom
      * up and then from the top down.  */
     for (int i=0; i<iter; i++) {
+        if (rev) {
+            sliced_foreach_segment(&ctx, me, movinv32_top_down);
+            { BAILR }
+        }
         sliced_foreach_segment(&ctx, me, movinv32_bottom_up);
         { BAILR }
 
-        sliced_foreach_segment(&ctx, me, movinv32_top_down);
-        { BAILR }
+        if (!rev) {
+            sliced_foreach_segment(&ctx, me, movinv32_top_down);
+            { BAILR }
+        }
+    }
+    if (rev) {
+        phase_set(me, PH_SHIFT, ~p1, ~lb, !sval, off);
+    } else {
+        phase_set(me, PH_SHIFT, p1, lb, sval, off);
     }
 }
 
@@ -1088,6 +2544,7 @@ void modtst(int offset, int iter, ulong p1, ulong p2, int me)
     ctx.offset = offset;
     ctx.p1 = p1;
     ctx.p2 = p2;
+    phase_forget(me);
 
     /* Display the current pattern */
     if (mstr_cpu == me) {
@@ -1298,46 +2755,20 @@ STATIC void block_move_move(ulong* restrict buf,
         // to the first 8 dwords of the first half.
         movsl(/*dest=*/ mid + half_len_dw - 8, /*src=*/ buf, 8);
 #else
-        asm __volatile__
-            (
-             "cld\n"
-             "jmp L110\n\t"
-
-             ".p2align 4,,7\n\t"
-             "L110:\n\t"
-
-             //
-             // At the end of all this 
-             // - the second half equals the inital value of the first half
-             // - the first half is right shifted 32-bytes (with wrapping)
-             //
-
-             // Move first half to second half
-             "movl %1,%%edi\n\t" // Destination 'mid' (mid point)
-             "movl %0,%%esi\n\t" // Source, 'buf' (start point)
-             "movl %2,%%ecx\n\t" // Length, 'half_len_dw' (size of a half in DWORDS)
-             "rep\n\t"
-             "movsl\n\t"
-
-             // Move the second half, less the last 32-bytes. To the first half, offset plus 32-bytes
-             "movl %0,%%edi\n\t"
-             "addl $32,%%edi\n\t"   // Destination 'buf' plus 32 bytes
-             "movl %1,%%esi\n\t"    // Source, 'mid'
-             "movl %2,%%ecx\n\t"
-             "subl $8,%%ecx\n\t"    // Length, 'half_len_dw'
-             "rep\n\t"
-             "movsl\n\t"
-
-             // Move last 8 DWORDS (32-bytes) of the second half to the start of the first half
-             "movl %0,%%edi\n\t"    // Destination 'buf'
-             // Source, 8 DWORDS from the end of the second half, left over by the last rep/movsl
-             "movl $8,%%ecx\n\t"    // Length, 8 DWORDS (32-bytes)
-             "rep\n\t"
-             "movsl\n\t"
-
-             :: "g" (buf), "g" (mid), "g" (half_len_dw)
-             : "edi", "esi", "ecx"
-             );
+        // At the end of all this
+        // - the second half equals the inital value of the first half
+        // - the first half is right shifted 32-bytes (with wrapping)
+
+        // Move first half to second half
+        kernel_move(/*dest=*/ mid, /*src=*/ buf, half_len_dw);
+
+        // Move the second half, less the last 32-bytes. To the first
+        // half, offset plus 32-bytes
+        kernel_move(/*dest=*/ buf + 8, /*src=*/ mid, half_len_dw - 8);
+
+        // Move last 8 DWORDS (32-bytes) of the second half to the
+        // start of the first half
+        kernel_move(/*dest=*/ buf, /*src=*/ mid + half_len_dw - 8, 8);
 #endif        
     }
 }
@@ -1408,6 +2839,7 @@ void block_move(int iter, int me)
     block_move_ctx ctx;
     ctx.iter = iter;
     ctx.me = me;
+    phase_forget(me);
 
     /* Initialize memory with the initial pattern.  */
     sliced_foreach_segment(&ctx, me, block_move_init);
@@ -1425,16 +2857,14 @@ void block_move(int iter, int me)
 
 typedef struct {
     ulong pat;
+    int me;
 } bit_fade_ctx;
 
 STATIC void bit_fade_fill_seg(ulong* restrict p,
                               ulong len_dw, const void* vctx) {
     const bit_fade_ctx* restrict ctx = (const bit_fade_ctx*)vctx;
-    ulong pat = ctx->pat;
 
-    for (ulong i = 0; i < len_dw; i++) {
-        p[i] = pat;
-    }
+    ret_fill(p, len_dw, ctx->pat, ctx->me);
 }
 
 /*
@@ -1448,20 +2878,17 @@ void bit_fade_fill(ulong p1, int me)
     /* Initialize memory with the initial pattern.  */
     bit_fade_ctx ctx;
     ctx.pat = p1;
+    ctx.me = me;
+    phase_forget(me);
     unsliced_foreach_segment(&ctx, me, bit_fade_fill_seg);
+    ret_arm[me] = 0;
 }
 
 STATIC void bit_fade_chk_seg(ulong* restrict p,
                              ulong len_dw, const void* vctx) {
     const bit_fade_ctx* restrict ctx = (const bit_fade_ctx*)vctx;
-    ulong pat = ctx->pat;
 
-    for (ulong i = 0; i < len_dw; i++) {
-        ulong bad;
-        if ((bad=p[i]) != pat) {
-            mt86_error(p+i, pat, bad);
-        }
-    }
+    kernel_check(p, len_dw, ctx->pat);
 }
 
 void bit_fade_chk(ulong p1, int me)
@@ -1485,6 +2912,10 @@ void sleep(long n, int flag, int me,
 
     /* loop for n seconds */
     while (1) {
+        /* Let the core idle between the time checks if it can */
+        if (cpu_id.ext_ecx & CPUID7_ECX_WAITPKG) {
+            tpause_for(vv->clks_msec);
+        }
         asm __volatile__(
                          "rep ; nop\n\t"
                          "rdtsc":"=a" (l),"=d" (h));
@@ -42,7 +42,9 @@ typedef unsigned long ulong;
 #define UNMAP_SZ_PAGES  (0x100000-WIN_SZ_PAGES)  /* Size of unmapped first segment */
 
 #define SPINSZ_DWORDS	0x4000000	/* 256 MB; units are dwords (32-bit words) */
+#define SHORT_SEG_DW	0x40000		/* 1 MB per CPU, less is not sliced */
 #define MOD_SZ		20
+#define TRIAGE_SAMPLE_SHIFT 4		/* triage tests 1 of 16 pages in movinvr */
 #define BAILOUT		if (bail) return(1);
 #define BAILR		if (bail) return;
 
@@ -96,6 +98,13 @@ typedef unsigned long ulong;
 #define CPM_RROBIN 2
 #define CPM_SEQ    3
 
+/* Test kernel variants */
+#define KERN_I486	0
+#define KERN_SSE2	1
+#define KERN_AVX2	2
+#define KERN_AVX512	3
+#define KERN_COUNT	4
+
 /* memspeed operations */
 #define MS_COPY		1
 #define MS_WRITE	2
@@ -132,7 +141,13 @@ void xprint(int y,int x,ulong val);
 void aprint(int y,int x,ulong page);
 void dprint(int y,int x,ulong val,int len, int right);
 void movinv1(int iter, ulong p1, ulong p2, int cpu);
-void movinvr(int cpu);
+void movinvr(ulong seed, int cpu);
+ulong rand_order(ulong seed, int cpu);
+void fill_verify(ulong p1, int cpu);
+void phase_forget(int cpu);
+int phase_fill(int cpu, ulong *pat);
+void bw_stream(ulong *p, ulong len_dw, int n);
+ulong test_pat(int tst, int i);
 void movinv32(int iter, ulong p1, ulong lb, ulong mb, int sval, int off,
 	int cpu);
 void modtst(int off, int iter, ulong p1, ulong p2, int cpu);
@@ -173,6 +188,8 @@ void print_ecc_err(ulong page, ulong offset, int corrected,
 	unsigned short syndrome, int channel);
 void mem_size(void);
 void adj_mem(void);
+void mem_range_add(int exclude, ulong start, ulong end);
+void pmap_ranges(void);
 ulong getval(int x, int y, int result_shift);
 int get_key(void);
 int ascii_to_keycode(int in);
@@ -195,6 +212,10 @@ void bit_fade_fill(unsigned long n, int cpu);
 void bit_fade_chk(unsigned long n, int cpu);
 void find_ticks_for_pass(void);
 void beep(unsigned int frequency);
+void triage_verdict(int fail, ulong *adr, ulong good, ulong bad);
+void hot_add(ulong page);
+int kernel_select(int want);
+const char *kernel_name(void);
 
 // Expose foreach_segment here for self_test, otherwise
 // it would be local to test.c:
@@ -337,6 +358,8 @@ struct vars {
 #define FIRMWARE_LINUXBIOS 2
 
 extern struct vars * const vv;
+extern ulong spin_dw;		/* dwords per tick, SPINSZ_DWORDS or tuned */
+extern ulong pat_seed;		/* boot time salt of test_pat() */
 extern unsigned char _start[], _end[], startup_32[];
 extern unsigned char _size, _pages;
 